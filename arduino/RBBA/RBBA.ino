@@ -44,27 +44,47 @@ than putting all the previously defined puzzle-pieces together.
 #include "encoder.h"
 #include "motor_control.h"
 #include "soft_bmp280.h"
+#include "diff_pressure.h"
+#include "pressure_log.h"
+#include "pressure_acquisition.h"
 #include "soft_hd44780.h"
 #include "lcd_menu.h"
 #include "text_buffer.h"
 #include "state_machine.h"
+#include "task_scheduler.h"
+#include "telemetry_frame.h"
+#include "eeprom_writer.h"
+#include "calib_store.h"
+#include "volume_curve.h"
+#include "alarm_engine.h"
 #include "string_constants.h"
 
 // configuration
 const uint8_t motor_enable_pin      = 3; // OC2B of timer2
 const uint8_t motor_direction_pin_A = 4;
 const uint8_t motor_direction_pin_B = 5;
-const uint8_t end_stop_opened_pin   = 7;
-const uint8_t end_stop_closed_pin   = 8;
+const uint8_t end_stop_opened_pin   = 7; // needs to be on a pin change interrupt pin (PCINT2_vect)
+const uint8_t end_stop_closed_pin   = 8; // needs to be on a pin change interrupt pin (PCINT0_vect)
 const uint8_t motor_encoder_pin_A   = 2; // needs to be on an interrupt pin
 const uint8_t motor_encoder_pin_B   = 6;
 
 const uint8_t control_loop_delay = 20;
 
-const uint8_t p1_slave_address = 0x77;
-const uint8_t p1_scl_pin       = A0;
-const uint8_t p1_sda_pin       = A1;
-const uint8_t p1_speed_khz     = 200;
+// the pressure sensors are on I2C by default, uncomment to use SPI instead
+//#define PRESSURE_SENSORS_ON_SPI
+#ifdef PRESSURE_SENSORS_ON_SPI
+const uint8_t p_sck_pin        = A0;
+const uint8_t p_mosi_pin       = A1;
+const uint8_t p_miso_pin       = A2;
+const uint8_t p1_cs_pin        = 9;  // patient side
+const uint8_t p2_cs_pin        = 10; // ambient reference, on the same bus
+#else
+const uint8_t p1_slave_address = 0x77; // patient side
+const uint8_t p2_slave_address = 0x76; // ambient reference, on the same bus
+const uint8_t p_scl_pin        = A0;
+const uint8_t p_sda_pin        = A1;
+const uint8_t p_speed_khz      = 200;
+#endif
 
 const uint8_t lcd_slave_address = 0x27;
 const uint8_t lcd_scl_pin       = 11;
@@ -75,6 +95,31 @@ const uint8_t knob_encoder_pin_A = A4;
 const uint8_t knob_encoder_pin_B = A3;
 const uint8_t knob_push_pin      = A5;
 
+// over pressure alarm, stops the motor, see AlarmEngine
+const int16_t max_pressure = 4000; // Pa, ~40 cmH2O
+
+// detection of inspiratory efforts, see TriggerDetector
+const uint8_t  trigger_sensitivity   = 100;  // Pa below PEEP, adjustable in the patient data
+const uint16_t trigger_refractory_ms = 500;  // after the end of a breath or a trigger
+
+// position of the bag between breaths and calibration steps, in % of the
+// range, all calibrated volumes are displaced from here, see VolumeCurve
+const uint8_t rest_position = 10;
+
+// test strokes from the calibration panel, e.g., into a test lung, see test_strokes
+const uint16_t test_stroke_volume   = 500;  // ml, with a volume calibration
+const uint16_t test_stroke_flow     = 500;  // ml/s, the stroke needs to end within test_inhale_ms
+const uint8_t  test_stroke_position = 60;   // % of the range, without a volume calibration
+const uint16_t test_inhale_ms       = 1500;
+const uint16_t test_cycle_ms        = 4000; // below the ~5s of a learning cycle of the motor control
+
+// automated bag volume calibration, the bag is connected to a closed 
+// container instead of a lung, see bag_autocal, at the max. pressure 
+// a sweep covers about 8% of the enclosed volume, i.e., ~1600 ml for 20 l
+const uint8_t  autocal_default_volume_l = 20;   // gas enclosed by bag, container and tubing at the rest position, adjustable in the panel
+const int16_t  autocal_max_pressure     = 9000; // Pa, aborts above, the BMP280 ends at 110 kPa absolute
+const uint8_t  autocal_speed          = 5;     // % of the range per second
+
 // implementation
 
 // encoder of the motor
@@ -91,8 +136,51 @@ MotorControl mc(
   encoder
 );
 
-// pressure sensor 1 input
-SoftBMP280 p1(p1_slave_address,p1_scl_pin,p1_sda_pin,p1_speed_khz);
+// pressure sensor inputs, gauge pressure is p1 - p2
+#ifdef PRESSURE_SENSORS_ON_SPI
+SoftSPI p_bus(p_sck_pin,p_mosi_pin,p_miso_pin);
+BMP280SPI p1_transport(p_bus,p1_cs_pin);
+BMP280SPI p2_transport(p_bus,p2_cs_pin);
+#else
+SoftI2C p_bus(p_scl_pin,p_sda_pin,p_speed_khz);
+BMP280I2C p1_transport(p_bus,p1_slave_address);
+BMP280I2C p2_transport(p_bus,p2_slave_address);
+#endif
+SoftBMP280 p1(p1_transport);
+SoftBMP280 p2(p2_transport);
+DiffPressure pressure(p1,p2);
+// samples the sensors in the background (timer0 compare interrupt)
+PressureAcquisition acquisition(pressure);
+
+// recent gauge pressure samples, breath metrics (PIP, PEEP, plateau)
+PressureLog<16,4,4> pressure_log;
+
+// sensor profile per breath phase (see SoftBMP280::Profile), fast while the
+// pressure rises, low noise for the plateau, no filter during the 
+// expiration, as the trigger detector looks for efforts there (the c4 
+// filter alone would add ~60 ms to the detection, see rbba_trigger_replay -f)
+const SoftBMP280::Profile pressure_profiles[3] = {
+  { SoftBMP280::Oversampling::x2, SoftBMP280::FilterCoeff::off }, // inspiration,  8.7 ms
+  { SoftBMP280::Oversampling::x8, SoftBMP280::FilterCoeff::c4  }, // plateau,    113 ms to 75%
+  { SoftBMP280::Oversampling::x4, SoftBMP280::FilterCoeff::off }  // expiration, 13.3 ms
+};
+BreathPhase pressure_phase = BreathPhase::expiration;
+
+// latched alarms, the pressure is checked in the acquisition interrupt
+AlarmEngine alarms(mc,pressure,max_pressure);
+uint8_t alarms_shown = 0;
+char alarm_text[14];
+
+// runs on every sample in the acquisition interrupt
+TriggerDetector patient_trigger(trigger_sensitivity,trigger_refractory_ms);
+volatile bool patient_triggered = false;
+
+// called from the acquisition interrupt, the flag is consumed by the 
+// test strokes, which start the next stroke early (assist), it must 
+// not touch the motor control, which is not interrupt safe
+void on_patient_trigger() {
+  patient_triggered = true;
+}
 
 // LCD display output
 SoftHD44780 lcd(lcd_slave_address,lcd_scl_pin,lcd_sda_pin,lcd_speed_khz);
@@ -119,25 +207,90 @@ bool bag_vol_calib_step_go = false;
 uint16_t bag_vol_value = 0;
 bool bag_vol_calib_next = false;
 
+bool run_bag_volume_autocal = false;
+uint16_t autocal_volume = 0;
+uint8_t autocal_volume_l = autocal_default_volume_l;
+
+bool run_test_strokes = false;
+bool test_strokes_stop = false;
+uint8_t test_stroke_cnt = 0;
+
+
+// EEPROM config storage and loading, see calib_store.h
+EepromWriter eeprom_writer;
+CalibrationStore calib_store(eeprom_writer);
+char active_profile_name[CalibrationStore::name_size];
+
+// volume <-> position of the bag in use, rebuilt with every calibration change
+VolumeCurve volume_curve;
+
+// volumes are displaced from the rest position
+int16_t rest_position_enc() {
+  return (int32_t)mc.get_max_encoder() * (int32_t)rest_position / (int32_t)100;
+}
+
+// the curve follows the volume table of the active bag profile, 
+// bag_vol_calib_data is filled with the volumes at the manual 
+// calibration points (20%, 30%, ... 100% of the range) for display
+void build_volume_curve() {
+  const int16_t  max_enc = mc.get_max_encoder();
+  const uint8_t  n       = CalibrationStore::nr_of_vol_points;
+  volume_curve.build(rest_position_enc(),max_enc / n,max_enc,calib_store.get_active_profile().volume,n);
+  for (uint8_t i = 0; i < 9; ++i)
+    bag_vol_calib_data[i] = volume_curve.position_to_volume((int32_t)max_enc * (int32_t)(2 + i) / (int32_t)10);
+}
+
+// resamples n volumes at evenly spaced positions from first_position up
+// to the end of the range onto the volume table of the active profile
+void set_bag_profile_volumes(const int16_t first_position, const uint16_t *volumes, const uint8_t n) {
+  const int16_t max_enc = mc.get_max_encoder();
+  const uint8_t points  = CalibrationStore::nr_of_vol_points;
+  uint16_t *table = calib_store.get_active_profile().volume;
+  volume_curve.build(rest_position_enc(),first_position,max_enc,volumes,n);
+  for (uint8_t i = 0; i < points; ++i)
+    table[i] = volume_curve.position_to_volume((int32_t)max_enc * (int32_t)(i + 1) / (int32_t)points);
+}
 
-// EEPROM config storage and loading
 void store_calibration() {
   mc_calibrate_enc = mc.get_max_encoder();
-  EEPROM.put(0,mc_calibrate_enc);
-  for(uint8_t i = 0; i < 9; ++i) {
-    uint16_t tmp = bag_vol_calib_data[i];
-    EEPROM.put(2+i*2,tmp);
+  calib_store.get_record().max_encoder = mc_calibrate_enc;
+  calib_store.store();
+  build_volume_curve();
+}
+
+void apply_bag_profile() {
+  memcpy(active_profile_name,calib_store.get_active_profile().name,sizeof(active_profile_name));
+  build_volume_curve();
+}
+
+// returns false if the device needs to be calibrated
+bool load_calibration() {
+  if (calib_store.load()) {
+    mc_calibrate_enc = calib_store.get_record().max_encoder;
+    mc.set_max_encoder(mc_calibrate_enc);
+    apply_bag_profile();
+    return mc_calibrate_enc > 0;
   }
+  // no valid record, import the calibration of an older firmware once,
+  // its volumes become the table of the first bag profile
+  int16_t max_enc;
+  if (calib_store.load_legacy(max_enc,bag_vol_calib_data)) {
+    mc.set_max_encoder(max_enc);
+    set_bag_profile_volumes(max_enc / 5,bag_vol_calib_data,CalibrationStore::legacy_nr_of_volumes);
+    apply_bag_profile();
+    store_calibration();
+    return true;
+  }
+  // without it, the motor keeps its default range
+  apply_bag_profile();
+  return false;
 }
 
-void load_calibration() {
-  EEPROM.get(0,mc_calibrate_enc);
-  mc.set_max_encoder(mc_calibrate_enc);
-  for(uint8_t i = 0; i < 9; ++i) {
-    uint16_t tmp;
-    EEPROM.get(2+i*2,tmp);
-    bag_vol_calib_data[i] = tmp;
-  }  
+// switching the bag only switches the volume calibration
+void select_bag_profile(const uint8_t i) {
+  calib_store.select_profile(i);
+  apply_bag_profile();
+  store_calibration();
 }
 
 
@@ -148,9 +301,23 @@ enum class panel_id : uint8_t {
   ABOUT,
   ENCODER_CAL,
   BAG_CAL_1,
-  BAG_CAL_2
+  BAG_CAL_2,
+  BAG_AUTOCAL,
+  MONITOR,
+  DIAGNOSTICS,
+  BAG_PROFILE,
+  ALARM,
+  TEST_STROKES
 };
 
+// where the alarm acknowledge returns to
+panel_id alarm_return_panel = panel_id::MAIN_SCREEN;
+
+// the task table is defined with the tasks further below
+extern TaskScheduler scheduler;
+uint16_t diag_overruns = 0;
+uint8_t  timing_dump_line = 0xFF; // next line of the serial dump, 0xFF if idle
+
 // setting up menu
 auto lcd_menu = make_menu(
   lcd,
@@ -172,6 +339,12 @@ auto lcd_menu = make_menu(
         }),
         new LCDMenuTextElement<panel_id>(2,3,str_About,[](LCDMenuBase<panel_id> *menu, LCDMenuElement<panel_id> *element){
           menu->switch_to_panel(panel_id::ABOUT);
+        }),
+        new LCDMenuFlashTextElement<panel_id>(10,3,str_Monitor,[](LCDMenuBase<panel_id> *menu, LCDMenuElement<panel_id> *element){
+          menu->switch_to_panel(panel_id::MONITOR);
+        }),
+        new LCDMenuFlashTextElement<panel_id>(15,2,str_diag,[](LCDMenuBase<panel_id> *menu, LCDMenuElement<panel_id> *element){
+          menu->switch_to_panel(panel_id::DIAGNOSTICS);
         })
       );
     }
@@ -183,6 +356,8 @@ auto lcd_menu = make_menu(
       return make_panel<panel_id>( 
         new LCDMenuTextElement<panel_id>(0,0,str_patient_data),
         new LCDMenuIntElement<panel_id,uint8_t,3,0>(1,1,&patient_height_cm,str_cm,8,true,110,855),
+        new LCDMenuFlashTextElement<panel_id>(1,2,str_trigger),
+        new LCDMenuIntElement<panel_id,uint8_t,3,0>(9,2,patient_trigger.sensitivity_ptr(),str_Pa,8,true,20,250),
         new LCDMenuTextElement<panel_id>(14,3,str_back,[](LCDMenuBase<panel_id> *menu, LCDMenuElement<panel_id> *element){
           menu->switch_to_panel(panel_id::MAIN_SCREEN);
         })
@@ -203,6 +378,18 @@ auto lcd_menu = make_menu(
           run_bag_volume_calibration = true;
           menu->switch_to_panel(panel_id::BAG_CAL_1);
         }),
+        new LCDMenuFlashTextElement<panel_id>(14,2,str_auto,[](LCDMenuBase<panel_id> *menu, LCDMenuElement<panel_id> *element){
+          tbuf.put_P(PSTR("set volume, start"));
+          menu->switch_to_panel(panel_id::BAG_AUTOCAL);
+        }),
+        new LCDMenuFlashTextElement<panel_id>(2,3,str_profile,[](LCDMenuBase<panel_id> *menu, LCDMenuElement<panel_id> *element){
+          menu->switch_to_panel(panel_id::BAG_PROFILE);
+        }),
+        new LCDMenuFlashTextElement<panel_id>(16,1,str_test,[](LCDMenuBase<panel_id> *menu, LCDMenuElement<panel_id> *element){
+          test_strokes_stop = false;
+          run_test_strokes  = true;
+          menu->switch_to_panel(panel_id::TEST_STROKES);
+        }),
         new LCDMenuTextElement<panel_id>(14,3,str_back,[](LCDMenuBase<panel_id> *menu, LCDMenuElement<panel_id> *element){
           menu->switch_to_panel(panel_id::MAIN_SCREEN);
         })
@@ -273,6 +460,139 @@ auto lcd_menu = make_menu(
         })
       );
     }
+  }),
+  // panel 7, automated bag calibration
+  Panel<panel_id>({ 
+    panel_id::BAG_AUTOCAL,
+    [](){
+      return make_panel<panel_id>( 
+        new LCDMenuFlashTextElement<panel_id>(0,0,str_bag_autocal),
+        new LCDMenuBufferElement<panel_id>(0,1,tbuf.get_buffer()),
+        new LCDMenuIntElement<panel_id,uint16_t,5,0>(0,2,&autocal_volume,str_ml,8),
+        new LCDMenuIntElement<panel_id,int16_t,6,0>(9,2,pressure_log.average_ptr(),str_empty,8),
+        new LCDMenuIntElement<panel_id,uint8_t,2,0>(1,3,&autocal_volume_l,str_l,8,true,2,60),
+        new LCDMenuFlashTextElement<panel_id>(7,3,str_start,[](LCDMenuBase<panel_id> *menu, LCDMenuElement<panel_id> *element){
+          run_bag_volume_autocal = true;
+        }),
+        new LCDMenuTextElement<panel_id>(14,3,str_back,[](LCDMenuBase<panel_id> *menu, LCDMenuElement<panel_id> *element){
+          if (run_bag_volume_autocal == false)
+            menu->switch_to_panel(panel_id::CALIBRATION_MAIN);
+        })
+      );
+    }
+  }),
+  // panel 8, pressure monitor
+  Panel<panel_id>({ 
+    panel_id::MONITOR,
+    [](){
+      return make_panel<panel_id>( 
+        new LCDMenuFlashTextElement<panel_id>(0,0,str_pressure_Pa),
+        new LCDMenuIntElement<panel_id,int16_t,6,0>(13,0,pressure_log.average_ptr(),str_empty,8),
+        new LCDMenuFlashTextElement<panel_id>(0,1,str_PIP),
+        new LCDMenuIntElement<panel_id,int16_t,6,0>(5,1,pressure_log.pip_ptr(),str_empty,16),
+        new LCDMenuFlashTextElement<panel_id>(13,1,str_trg),
+        new LCDMenuIntElement<panel_id,uint8_t,3,0>(17,1,patient_trigger.trigger_count_ptr(),str_empty,16),
+        new LCDMenuFlashTextElement<panel_id>(0,2,str_PEEP),
+        new LCDMenuIntElement<panel_id,int16_t,6,0>(5,2,pressure_log.peep_ptr(),str_empty,16),
+        new LCDMenuFlashTextElement<panel_id>(0,3,str_plateau),
+        new LCDMenuIntElement<panel_id,int16_t,6,0>(5,3,pressure_log.plateau_ptr(),str_empty,16),
+        new LCDMenuTextElement<panel_id>(14,3,str_back,[](LCDMenuBase<panel_id> *menu, LCDMenuElement<panel_id> *element){
+          menu->switch_to_panel(panel_id::MAIN_SCREEN);
+        })
+      );
+    }
+  }),
+  // panel 9, timing diagnostics of the first three tasks in ticks (4uS),
+  // columns are avg / max execution time and max start delay (jitter)
+  Panel<panel_id>({ 
+    panel_id::DIAGNOSTICS,
+    [](){
+      return make_panel<panel_id>( 
+        new LCDMenuFlashTextElement<panel_id>(0,0,scheduler.get_task(0).name),
+        new LCDMenuIntElement<panel_id,uint16_t,5,0>(4,0,scheduler.get_task(0).exec.avg_ptr(),str_empty,16),
+        new LCDMenuIntElement<panel_id,uint16_t,5,0>(9,0,scheduler.get_task(0).exec.max_ptr(),str_empty,16),
+        new LCDMenuIntElement<panel_id,uint16_t,5,0>(15,0,scheduler.get_task(0).late->max_ptr(),str_empty,16),
+        new LCDMenuFlashTextElement<panel_id>(0,1,scheduler.get_task(1).name),
+        new LCDMenuIntElement<panel_id,uint16_t,5,0>(4,1,scheduler.get_task(1).exec.avg_ptr(),str_empty,16),
+        new LCDMenuIntElement<panel_id,uint16_t,5,0>(9,1,scheduler.get_task(1).exec.max_ptr(),str_empty,16),
+        new LCDMenuIntElement<panel_id,uint16_t,5,0>(15,1,scheduler.get_task(1).late->max_ptr(),str_empty,16),
+        new LCDMenuFlashTextElement<panel_id>(0,2,scheduler.get_task(2).name),
+        new LCDMenuIntElement<panel_id,uint16_t,5,0>(4,2,scheduler.get_task(2).exec.avg_ptr(),str_empty,16),
+        new LCDMenuIntElement<panel_id,uint16_t,5,0>(9,2,scheduler.get_task(2).exec.max_ptr(),str_empty,16),
+        new LCDMenuIntElement<panel_id,uint16_t,5,0>(15,2,scheduler.get_task(2).late->max_ptr(),str_empty,16),
+        new LCDMenuFlashTextElement<panel_id>(0,3,str_ov),
+        new LCDMenuIntElement<panel_id,uint16_t,4,0>(2,3,&diag_overruns,str_empty,16),
+        new LCDMenuFlashTextElement<panel_id>(8,3,str_dump,[](LCDMenuBase<panel_id> *menu, LCDMenuElement<panel_id> *element){
+          timing_dump_line = 0;
+        }),
+        new LCDMenuTextElement<panel_id>(14,3,str_back,[](LCDMenuBase<panel_id> *menu, LCDMenuElement<panel_id> *element){
+          menu->switch_to_panel(panel_id::MAIN_SCREEN);
+        })
+      );
+    }
+  }),
+  // panel 10, bag profile selection
+  Panel<panel_id>({ 
+    panel_id::BAG_PROFILE,
+    [](){
+      CalibrationStore::Record &r = calib_store.get_record();
+      return make_panel<panel_id>( 
+        new LCDMenuFlashTextElement<panel_id>(0,0,str_bag_profile),
+        new LCDMenuBufferElement<panel_id>(13,0,active_profile_name),
+        new LCDMenuTextElement<panel_id>(2,1,r.profiles[0].name,[](LCDMenuBase<panel_id> *menu, LCDMenuElement<panel_id> *element){
+          select_bag_profile(0);
+        }),
+        new LCDMenuTextElement<panel_id>(11,1,r.profiles[1].name,[](LCDMenuBase<panel_id> *menu, LCDMenuElement<panel_id> *element){
+          select_bag_profile(1);
+        }),
+        new LCDMenuTextElement<panel_id>(2,2,r.profiles[2].name,[](LCDMenuBase<panel_id> *menu, LCDMenuElement<panel_id> *element){
+          select_bag_profile(2);
+        }),
+        new LCDMenuTextElement<panel_id>(11,2,r.profiles[3].name,[](LCDMenuBase<panel_id> *menu, LCDMenuElement<panel_id> *element){
+          select_bag_profile(3);
+        }),
+        new LCDMenuTextElement<panel_id>(14,3,str_back,[](LCDMenuBase<panel_id> *menu, LCDMenuElement<panel_id> *element){
+          menu->switch_to_panel(panel_id::CALIBRATION_MAIN);
+        })
+      );
+    }
+  }),
+  // panel 11, alarms, shown by the menu task when an alarm latches
+  Panel<panel_id>({ 
+    panel_id::ALARM,
+    [](){
+      return make_panel<panel_id>( 
+        new LCDMenuFlashTextElement<panel_id>(0,0,str_alarm),
+        new LCDMenuBufferElement<panel_id>(7,0,alarm_text),
+        new LCDMenuIntElement<panel_id,uint8_t,3,0>(0,1,&alarms_shown,str_empty,8),
+        new LCDMenuFlashTextElement<panel_id>(10,3,str_ack,[](LCDMenuBase<panel_id> *menu, LCDMenuElement<panel_id> *element){
+          alarms.acknowledge();
+          alarms_shown = 0;
+          // a running calibration may wait for input on its panel
+          menu->switch_to_panel(alarm_return_panel);
+        })
+      );
+    }
+  }),
+  // panel 12, repeated test strokes
+  Panel<panel_id>({ 
+    panel_id::TEST_STROKES,
+    [](){
+      return make_panel<panel_id>( 
+        new LCDMenuFlashTextElement<panel_id>(0,0,str_test_strokes),
+        new LCDMenuIntElement<panel_id,uint8_t,3,0>(14,0,&test_stroke_cnt,str_empty,8),
+        new LCDMenuBufferElement<panel_id>(0,1,tbuf.get_buffer()),
+        new LCDMenuFlashTextElement<panel_id>(0,2,str_PIP),
+        new LCDMenuIntElement<panel_id,int16_t,6,0>(5,2,pressure_log.pip_ptr(),str_empty,16),
+        new LCDMenuFlashTextElement<panel_id>(8,3,str_stop,[](LCDMenuBase<panel_id> *menu, LCDMenuElement<panel_id> *element){
+          test_strokes_stop = true;
+        }),
+        new LCDMenuTextElement<panel_id>(14,3,str_back,[](LCDMenuBase<panel_id> *menu, LCDMenuElement<panel_id> *element){
+          if (run_test_strokes == false)
+            menu->switch_to_panel(panel_id::CALIBRATION_MAIN);
+        })
+      );
+    }
   })
 );
 
@@ -280,14 +600,12 @@ auto lcd_menu = make_menu(
 
 
 // state machines
-uint16_t mc_calibrate_dtime;
-
 enum class mc_calibrate_state : uint8_t {
   start,
   clear_endswitch,
+  clear_margin,
   move_home,
   move_max,
-  finish,
   return_
 };
 
@@ -295,57 +613,52 @@ auto mc_calibrate = make_state_machine(
   mc_calibrate_state::start,
   mc_calibrate_state::return_,
 
-  make_state( mc_calibrate_state::start,  
+  make_state<mc_calibrate_state,mc_calibrate_state::start>(  
   []() -> mc_calibrate_state {
-    tbuf.put("moving to min");
-    if (mc.open_end_stop()) {
-      mc_calibrate_dtime = millis() & (uint32_t)1023;
-      mc.move_raw(mc.home_PWM,1);
+    tbuf.put_P(PSTR("moving to min"));
+    if (mc.open_end_stop())
       return mc_calibrate_state::clear_endswitch;
-    }
     return mc_calibrate_state::move_home;
   }),
   
-  make_state( mc_calibrate_state::clear_endswitch,
+  // move away from the end switch until it is released ...
+  make_state<mc_calibrate_state,mc_calibrate_state::clear_endswitch>(
   []() -> mc_calibrate_state {
     if (mc.open_end_stop())
       return mc_calibrate_state::clear_endswitch;
-    uint16_t now = millis() & (uint32_t)1023;
-    if (((now + 1024 - mc_calibrate_dtime) & 1023) > 200)
-      return mc_calibrate_state::move_home;
-    return mc_calibrate_state::clear_endswitch;
-  }),
+    return mc_calibrate_state::clear_margin;
+  }).with_entry([](){ mc.move_raw(mc.home_PWM,1); }),
 
-  make_state( mc_calibrate_state::move_home,
-  []() -> mc_calibrate_state {
-    mc.move_raw(mc.home_PWM,0);
-    return mc_calibrate_state::move_max;
-  }),
-  
-  make_state( mc_calibrate_state::move_max,
+  // ... and a bit further
+  make_state<mc_calibrate_state,mc_calibrate_state::clear_margin>()
+  .with_timeout(200,mc_calibrate_state::move_home),
+
+  make_state<mc_calibrate_state,mc_calibrate_state::move_home>(
   []() -> mc_calibrate_state {
     if (mc.open_end_stop()) {
-      tbuf.put("moving to max");
       mc.hard_stop();
-      mc.zero_enc();
+      mc.zero_enc_at_end_stop();
       mc_calibrate_enc = 0;
-      mc.move_raw(mc.home_PWM,1);
-      return mc_calibrate_state::finish;
+      return mc_calibrate_state::move_max;
     }
-    return mc_calibrate_state::move_max;
-  }),
-
-  make_state( mc_calibrate_state::finish,
+    return mc_calibrate_state::move_home;
+  }).with_entry([](){ mc.move_raw(mc.home_PWM,0); }),
+  
+  make_state<mc_calibrate_state,mc_calibrate_state::move_max>(
   []() -> mc_calibrate_state {
     mc_calibrate_enc = mc.get_encoder_value();
     if (mc.close_end_stop()) {
-      tbuf.put("encoder cal done");
+      tbuf.put_P(PSTR("encoder cal done"));
       mc.hard_stop();
-      mc.max_enc();
-      mc.move_const_speed(10,100);
+      mc.max_enc_at_end_stop();
+      mc_calibrate_enc = mc.get_max_encoder();
+      mc.move_const_speed(rest_position,100);
       return mc_calibrate_state::return_;
     }
-    return mc_calibrate_state::finish;
+    return mc_calibrate_state::move_max;
+  }).with_entry([](){ 
+    tbuf.put_P(PSTR("moving to max"));
+    mc.move_raw(mc.home_PWM,1); 
   })
 );
 
@@ -364,7 +677,7 @@ auto bag_calibrate = make_state_machine(
   bag_calib_state::start,
   bag_calib_state::return_,
 
-  make_state( bag_calib_state::start,  
+  make_state<bag_calib_state,bag_calib_state::start>(  
   []() -> bag_calib_state {
     bag_vol_calib_step = 1;
     bag_vol_value = 0;
@@ -373,18 +686,18 @@ auto bag_calibrate = make_state_machine(
     return bag_calib_state::begin_step;
   }),
 
-  make_state( bag_calib_state::begin_step,  
+  make_state<bag_calib_state,bag_calib_state::begin_step>(  
   []() -> bag_calib_state {
     if (bag_vol_calib_step_go) {
       bag_vol_calib_step_go = false;
       lcd_menu.switch_to_panel(panel_id::BAG_CAL_2);
-      mc.move_const_speed(10+bag_vol_calib_step*10,75);
+      mc.move_const_speed(rest_position+bag_vol_calib_step*10,75);
       return bag_calib_state::end_step;
     }
     return bag_calib_state::begin_step;
   }),
 
-  make_state( bag_calib_state::end_step,  
+  make_state<bag_calib_state,bag_calib_state::end_step>(  
   []() -> bag_calib_state {
     if (bag_vol_calib_next) {
       bag_vol_calib_next = false;
@@ -392,10 +705,10 @@ auto bag_calibrate = make_state_machine(
       if (bag_vol_calib_step < 9) {
         ++bag_vol_calib_step;
         lcd_menu.switch_to_panel(panel_id::BAG_CAL_1);
-        mc.move_const_speed(10,75);
+        mc.move_const_speed(rest_position,75);
         return bag_calib_state::begin_step;
       }
-      mc.move_const_speed(10,75);
+      mc.move_const_speed(rest_position,75);
       lcd_menu.switch_to_panel(panel_id::CALIBRATION_MAIN);
       return bag_calib_state::return_;
     }
@@ -407,69 +720,269 @@ auto bag_calibrate = make_state_machine(
 
 
 
-ISR(PCINT1_vect)
-{
-  knob_encoder.update();
+/*
+  Automated bag volume calibration
+
+  The bag outlet is connected to a closed container, its volume (incl.
+  bag and tubing) is entered in the panel. Starting from the rest 
+  position, like the manual calibration, the bag is compressed slowly
+  over the whole range, so
+  the gas stays at ambient temperature and Boyle's law holds: 
+  p0 * V = p * (V - dV), i.e., the displaced volume is 
+  dV = V * (p - p0) / p with absolute pressures and V the enclosed volume
+  at the rest position. The volume is interpolated at the positions of 
+  the volume table of the bag profile while passing them. If the 
+  pressure limit is reached before the end of the range, the container
+  is too small for the bag, the table is left unchanged then.
+*/
+enum class bag_autocal_state : uint8_t {
+  start,
+  settle,
+  sweep,
+  done,
+  abort,
+  return_
+};
+
+uint16_t autocal_data[CalibrationStore::nr_of_vol_points];
+uint16_t autocal_enclosed_ml; // fixed at the start of the sweep
+uint8_t  autocal_point;
+int16_t  autocal_p0;
+int32_t  autocal_ambient; // Pa, absolute
+int16_t  autocal_prev_pos;
+uint16_t autocal_prev_vol;
+
+uint16_t autocal_displaced_volume(const int16_t gauge) {
+  const int32_t dp = (int32_t)gauge - (int32_t)autocal_p0;
+  if (dp <= 0)
+    return 0;
+  return (uint32_t)autocal_enclosed_ml * (uint32_t)dp / (uint32_t)(autocal_ambient + gauge);
 }
 
+auto bag_autocal = make_state_machine(
+  bag_autocal_state::start,
+  bag_autocal_state::return_,
 
-void setup() {
-//  Serial.begin(115200);
-  
-  lcd.init();
-  
-  lcd.set_cursor(0,0);
-  lcd.print("Initializing...");
+  make_state<bag_autocal_state,bag_autocal_state::start>(  
+  []() -> bag_autocal_state {
+    autocal_volume = 0;
+    if (!mc.get_max_encoder()) {
+      tbuf.put_P(PSTR("no encoder cal"));
+      return bag_autocal_state::return_;
+    }
+    tbuf.put_P(PSTR("opening"));
+    mc.move_const_speed(rest_position,50);
+    return bag_autocal_state::settle;
+  }),
 
-  delay(1000);
+  // wait for the bag to reach the rest position and the pressure to settle
+  make_state<bag_autocal_state,bag_autocal_state::settle>()
+  .with_timeout(3000,bag_autocal_state::sweep),
+
+  make_state<bag_autocal_state,bag_autocal_state::sweep>(
+  []() -> bag_autocal_state {
+    const int16_t p = pressure_log.get_average();
+    if (p > autocal_max_pressure) {
+      tbuf.put_P(PSTR("container too small"));
+      return bag_autocal_state::abort;
+    }
+    const int16_t  pos     = mc.get_encoder_value();
+    const uint16_t vol     = autocal_displaced_volume(p);
+    const int16_t  max_enc = mc.get_max_encoder();
+    const uint8_t  n       = CalibrationStore::nr_of_vol_points;
+    autocal_volume = vol;
+    while (autocal_point < n) {
+      const int16_t x = (int32_t)max_enc * (int32_t)(autocal_point + 1) / (int32_t)n;
+      // the position control stops a few ticks short of the end
+      const int16_t margin = autocal_point == n - 1 ? 8 : 0;
+      if (pos < x - margin)
+        break;
+      if ((pos <= x) || (pos == autocal_prev_pos))
+        autocal_data[autocal_point] = vol;
+      else
+        autocal_data[autocal_point] = autocal_prev_vol + ((int32_t)vol - (int32_t)autocal_prev_vol) * (int32_t)(x - autocal_prev_pos) / (int32_t)(pos - autocal_prev_pos);
+      ++autocal_point;
+    }
+    autocal_prev_pos = pos;
+    autocal_prev_vol = vol;
+    if (autocal_point >= n)
+      return bag_autocal_state::done;
+    return bag_autocal_state::sweep;
+  }).with_entry([](){
+    tbuf.put_P(PSTR("sweeping"));
+    autocal_enclosed_ml = (uint16_t)autocal_volume_l * 1000;
+    autocal_point    = 0;
+    autocal_p0       = pressure_log.get_average();
+    PressureSnapshot snap;
+    acquisition.get_snapshot(snap);
+    autocal_ambient  = snap.ambient_pressure ? snap.ambient_pressure : 101325;
+    autocal_prev_pos = mc.get_encoder_value();
+    autocal_prev_vol = 0;
+    // the container is no patient, the sweep watches the pressure itself
+    alarms.set_max_pressure(autocal_max_pressure + 1000);
+    mc.move_const_speed(100,autocal_speed);
+  }).with_timeout(40000,bag_autocal_state::abort),
+
+  make_state<bag_autocal_state,bag_autocal_state::done>(
+  []() -> bag_autocal_state {
+    alarms.set_max_pressure(max_pressure);
+    tbuf.put_P(PSTR("auto cal done"));
+    set_bag_profile_volumes(mc.get_max_encoder() / CalibrationStore::nr_of_vol_points,autocal_data,CalibrationStore::nr_of_vol_points);
+    store_calibration();
+    mc.move_const_speed(rest_position,75);
+    return bag_autocal_state::return_;
+  }),
+
+  make_state<bag_autocal_state,bag_autocal_state::abort>(
+  []() -> bag_autocal_state {
+    alarms.set_max_pressure(max_pressure);
+    mc.move_const_speed(rest_position,75);
+    return bag_autocal_state::return_;
+  })
+);
 
-  // attach encoder update to interrupt
-  attachInterrupt(digitalPinToInterrupt(motor_encoder_pin_A),[](){encoder.update();},CHANGE);
 
-  // attach knob encoder to interrupt (the avr way)
-  PCICR  |= 2;
-  PCMSK1 |= 16; // pin PC4 aka A4
 
-  lcd.set_cursor(0,1);
-  lcd.print("p1 init");
-  // calibrate pressure sensor
-  p1.load_calibration();
-  
-  // configure pressure sensor
-  p1.set_temp_oversampling(SoftBMP280::Oversampling::x1);
-  p1.set_pressure_oversampling(SoftBMP280::Oversampling::x4);
-  p1.set_filter_coeff(SoftBMP280::FilterCoeff::off);
-  p1.set_standby_time(SoftBMP280::StandbyTime::ms0_5);
-  
-  p1.set_mode(SoftBMP280::Mode::normal);
 
-  load_calibration();
+/*
+  Test strokes
 
-  // setting up timer1 for the main loop
-  // in normal mode
-  TCCR1A = 0;
-  TCCR1B = 3; // prescaler of 64 -> 250 ticks per millisecond
-  TCCR1C = 0;  
+  Repeats a stroke from the rest position and back every test_cycle_ms
+  until stopped. With a volume calibration, the stroke displaces 
+  test_stroke_volume at the constant flow test_stroke_flow, otherwise 
+  it goes to test_stroke_position in test_inhale_ms. Every stroke starts a cycle of
+  the learning layer of the motor control, so the tracking of the 
+  repeated motion improves from stroke to stroke. Learning is switched
+  off again when stopped, the learned corrections are kept.
+
+  A patient trigger during the exhale starts the next stroke right away
+  (assist), triggers during the inhale are dropped.
+*/
+enum class test_stroke_state : uint8_t {
+  start,
+  inhale,
+  exhale,
+  stop,
+  return_
+};
+
+auto test_strokes = make_state_machine(
+  test_stroke_state::start,
+  test_stroke_state::return_,
+
+  // move to the rest position first
+  make_state<test_stroke_state,test_stroke_state::start>(
+  []() -> test_stroke_state {
+    if (!mc.get_max_encoder()) {
+      tbuf.put_P(PSTR("no encoder cal"));
+      return test_stroke_state::return_;
+    }
+    if (test_strokes_stop)
+      return test_stroke_state::stop;
+    return test_stroke_state::start;
+  }).with_entry([](){
+    tbuf.put_P(volume_curve.is_valid() ? PSTR("stroking, flow") : PSTR("stroking, no vol cal"));
+    test_stroke_cnt = 0;
+    mc.move_const_speed(rest_position,50);
+  }).with_timeout(2000,test_stroke_state::inhale),
+
+  make_state<test_stroke_state,test_stroke_state::inhale>(
+  []() -> test_stroke_state {
+    return test_strokes_stop ? test_stroke_state::stop : test_stroke_state::inhale;
+  }).with_entry([](){
+    ++test_stroke_cnt;
+    patient_triggered = false;
+    mc.set_learning(true);
+    mc.start_cycle();
+    if (!mc.move_volume_const_flow(test_stroke_volume,test_stroke_flow))
+      mc.move_const_time(test_stroke_position,test_inhale_ms);
+  }).with_timeout(test_inhale_ms,test_stroke_state::exhale),
+
+  make_state<test_stroke_state,test_stroke_state::exhale>(
+  []() -> test_stroke_state {
+    if (test_strokes_stop)
+      return test_stroke_state::stop;
+    return patient_triggered ? test_stroke_state::inhale : test_stroke_state::exhale;
+  }).with_entry([](){
+    mc.move_const_time(rest_position,test_cycle_ms - test_inhale_ms);
+  }).with_timeout(test_cycle_ms - test_inhale_ms,test_stroke_state::inhale),
+
+  make_state<test_stroke_state,test_stroke_state::stop>(
+  []() -> test_stroke_state {
+    tbuf.put_P(PSTR("stopped"));
+    mc.set_learning(false);
+    mc.move_const_speed(rest_position,50);
+    return test_stroke_state::return_;
+  })
+);
+
+
+
+
+ISR(PCINT1_vect)
+{
+  knob_encoder.update();
+}
+
+// end stops of the motor (see configuration)
+ISR(PCINT0_vect)
+{
+  mc.end_stop_isr();
+}
+
+ISR(PCINT2_vect)
+{
+  mc.end_stop_isr();
 }
 
-const uint16_t ticks_per_ms = 250;
 
-uint8_t tmpcnt = 0;
+// wakes the cpu from idle sleep at the next release of the scheduler
+ISR(TIMER1_COMPA_vect)
+{
+}
 
-void loop() {
-  
-  TCNT1 = 0;
-  
-  mc.update(); // measured as 15 ticks -> 60uS
+ISR(TIMER0_COMPA_vect)
+{
+  acquisition.isr();
+}
 
-  // lets make this first slot 100uS then (4uS per tick)
-  while(TCNT1 < 100 / 4);
+// programs the queued calibration bytes, one per interrupt
+ISR(EE_READY_vect)
+{
+  eeprom_writer.isr();
+}
 
-  p1.read_sensor_data();
+// moves the samples of the background acquisition into the pressure log
+void acquire_pressure() {
+  PressureSample sample;
+  while (acquisition.pop_sample(sample)) {
+    pressure_log.add(sample.time_ms,sample.pressure);
+    // switch the sensor profile if the breath phase changed
+    const BreathPhase phase = pressure_log.get_phase();
+    if (phase != pressure_phase) {
+      pressure_phase = phase;
+      acquisition.request_profile(pressure_profiles[static_cast<uint8_t>(phase)]);
+    }
+  }
+}
 
-  // this slot neets to be 1000 ticks long (4ms)
-  while(TCNT1 < 1000);
+// tasks of the main loop
+void control_task() {
+  TimerService::tick();
+  PressureSnapshot snap;
+  acquisition.get_snapshot(snap);
+  // the bag calibrations compress an open bag, no pressure rise expected
+  alarms.check_control(
+    TimerService::now(),
+    snap.get_gauge_16(),
+    snap.sequence,
+    !run_motor_encoder_calibration,
+    !(run_motor_encoder_calibration || run_bag_volume_calibration || run_bag_volume_autocal)
+  );
+  mc.update(); // measured as 15 ticks -> 60uS, see the diagnostics panel
+}
 
+void calibration_task() {
   if ((run_motor_encoder_calibration) && (mc_calibrate.execute_step())) {
     run_motor_encoder_calibration = false;
     store_calibration();
@@ -477,11 +990,210 @@ void loop() {
 
   if ((run_bag_volume_calibration) && (bag_calibrate.execute_step())) {
     run_bag_volume_calibration = false;
+    set_bag_profile_volumes(mc.get_max_encoder() / 5,bag_vol_calib_data,9);
     store_calibration();
   }
 
+  if ((run_bag_volume_autocal) && (bag_autocal.execute_step()))
+    run_bag_volume_autocal = false;
+
+  if ((run_test_strokes) && (test_strokes.execute_step()))
+    run_test_strokes = false;
+
+  calib_store.update();
+}
+
+void menu_task() {
+  diag_overruns = scheduler.get_overruns();
+  const uint8_t latched = alarms.get_latched();
+  if (latched & ~alarms_shown) {
+    // a new alarm, show the one with the highest priority
+    alarms_shown = latched;
+    const uint8_t i = static_cast<uint8_t>(alarms.get_highest());
+    memset(alarm_text,' ',sizeof(alarm_text) - 1);
+    alarm_text[sizeof(alarm_text) - 1] = 0;
+    const char *name = (const char*)pgm_read_ptr(&str_alarm_names[i]);
+    memcpy_P(alarm_text,name,strlen_P(name));
+    if (lcd_menu.get_cur_panel() != panel_id::ALARM)
+      alarm_return_panel = lcd_menu.get_cur_panel();
+    lcd_menu.switch_to_panel(panel_id::ALARM);
+  }
   lcd_menu.update();
-    
-  while(TCNT1 < (const uint16_t)control_loop_delay * ticks_per_ms);
+}
+
+// binary telemetry stream, see telemetry_frame.h
+TelemetryEncoder telemetry;
+uint8_t telemetry_dropped = 0;
+
+// the frame only goes out if it fits into the tx buffer of Serial, 
+// otherwise it is dropped and the next one becomes a key frame
+void telemetry_task() {
+  // the text dump shares the uart, keep the stream quiet meanwhile
+  if (timing_dump_line != 0xFF) {
+    telemetry.invalidate();
+    return;
+  }
+  PressureSnapshot snap;
+  acquisition.get_snapshot(snap);
+  TelemetrySample s;
+  s.time_ms      = millis();
+  s.pressure     = snap.get_gauge_16();
+  s.enc_value    = mc.get_encoder_value();
+  s.set_position = mc.get_set_position();
+  s.pwm          = mc.get_pwm();
+  s.state[0]     = static_cast<uint8_t>(pressure_log.get_phase());
+  s.state[1]     = mc_calibrate.get_state();
+  s.state[2]     = bag_calibrate.get_state();
+  s.state[3]     = alarms.get_latched();
+  s.dropped      = telemetry_dropped;
+  uint8_t frame[TelemetryFrame::max_size];
+  const uint8_t size = telemetry.encode(s,frame);
+  if (Serial.availableForWrite() < size) {
+    ++telemetry_dropped;
+    telemetry.invalidate();
+    return;
+  }
+  Serial.write(frame,size);
+}
+
+// task names are in flash, too
+const __FlashStringHelper* flash_str(const char *s) {
+  return reinterpret_cast<const __FlashStringHelper*>(s);
+}
+
+void print_timing_line(const char *name, const __FlashStringHelper *kind, const TimingStats &st, const bool hist) {
+  Serial.print(flash_str(name));
+  Serial.print(kind);
+  if (hist) {
+    for (uint8_t i = 0; i < TimingStats::nr_of_bins; ++i) {
+      Serial.print(' ');
+      Serial.print(st.get_bin(i));
+    }
+  } else {
+    Serial.print(st.get_min()); Serial.print(' ');
+    Serial.print(st.get_avg()); Serial.print(' ');
+    Serial.print(st.get_max());
+  }
+  Serial.println();
+}
+
+// prints the timing statistics of the tasks, a few lines (< 64 chars) per
+// run and only into an empty tx buffer, so the dump never blocks the loop
+void timing_dump_task() {
+  if (timing_dump_line == 0xFF)
+    return;
+  if (Serial.availableForWrite() < 63)
+    return;
+  Task &t = scheduler.get_task(timing_dump_line >> 2);
+  switch (timing_dump_line & 3) {
+    case 0 : 
+      print_timing_line(t.name,F(" exec min/avg/max "),t.exec,false);
+      Serial.print(flash_str(t.name)); Serial.print(F(" overruns ")); Serial.println(t.overruns);
+      break;
+    case 1 : print_timing_line(t.name,F(" exec hist"),t.exec,true); break;
+    case 2 : print_timing_line(t.name,F(" late min/avg/max "),*t.late,false); break;
+    case 3 : print_timing_line(t.name,F(" late hist"),*t.late,true); break;
+  }
+  ++timing_dump_line;
+  // background tasks have no release, skip their late lines
+  if ((!t.late) && ((timing_dump_line & 3) == 2))
+    timing_dump_line += 2;
+  if ((timing_dump_line >> 2) >= scheduler.get_task_count())
+    timing_dump_line = 0xFF;
+}
+
+const uint16_t control_period = (uint16_t)control_loop_delay * TaskScheduler::ticks_per_ms;
+
+// periodic tasks of the same release run in the order of their priority,
+// the menu gets whatever time is left
+const char task_name_ctl[] PROGMEM = "ctl";
+const char task_name_prs[] PROGMEM = "prs";
+const char task_name_cal[] PROGMEM = "cal";
+const char task_name_tlm[] PROGMEM = "tlm";
+const char task_name_lcd[] PROGMEM = "lcd";
+const char task_name_dmp[] PROGMEM = "dmp";
+
+TimingStats task_late[4];
+
+Task tasks[] = {
+  // function,         period,         offset, priority, name (diagnostics), start delay
+  { control_task,      control_period, 0,      0,        task_name_ctl,      &task_late[0] },
+  { acquire_pressure,  control_period, 0,      1,        task_name_prs,      &task_late[1] },
+  { calibration_task,  control_period, 0,      2,        task_name_cal,      &task_late[2] },
+  { telemetry_task,    control_period, 0,      3,        task_name_tlm,      &task_late[3] },
+  { menu_task,         0,              0,      0,        task_name_lcd,      nullptr       },
+  { timing_dump_task,  0,              0,      0,        task_name_dmp,      nullptr       }
+};
+
+TaskScheduler scheduler(tasks,sizeof(tasks) / sizeof(Task),control_period / 2);
+
+void configure_pressure_sensor(SoftBMP280 &p) {
+  const SoftBMP280::Profile &profile = pressure_profiles[static_cast<uint8_t>(pressure_phase)];
+  p.set_temp_oversampling(SoftBMP280::Oversampling::x1);
+  p.set_pressure_oversampling(profile.pressure_os);
+  p.set_filter_coeff(profile.filter);
+  p.commit_configuration();
+  // the control path only needs the pressure at the loop rate,
+  // temperature is included about once a second
+  p.set_temp_interval(1000 / control_loop_delay);
+}
+
+void setup() {
+  Serial.begin(115200);
+  
+  lcd.init();
+  
+  lcd.set_cursor(0,0);
+  lcd.print("Initializing...");
+
+  delay(1000);
+
+  // attach encoder update to interrupt
+  attachInterrupt(digitalPinToInterrupt(motor_encoder_pin_A),[](){encoder.update();},CHANGE);
+
+  // attach knob encoder to interrupt (the avr way)
+  PCICR  |= 2;
+  PCMSK1 |= 16; // pin PC4 aka A4
+
+  // latch the end stops via pin change interrupts
+  mc.enable_end_stop_interrupts();
+  mc.set_volume_curve(&volume_curve);
+
+  lcd.set_cursor(0,1);
+  lcd.print("p1 init");
+  // calibrate pressure sensors
+  pressure.load_calibration();
+  
+  // configure pressure sensors
+  configure_pressure_sensor(p1);
+  if (pressure.has_ambient())
+    configure_pressure_sensor(p2);
+
+  // conversions are triggered by poll_sensor_data as soon as the previous one is read
+  pressure.start_acquisition();
+
+  // both sensors see ambient pressure during startup
+  for (uint8_t i = 0; (i < 50) && (!pressure.poll_sensor_data()); ++i)
+    delay(1);
+  pressure.zero();
+
+  // from here on the sensor bus belongs to the background acquisition
+  acquisition.set_trigger(&patient_trigger,on_patient_trigger);
+  acquisition.set_alarms(&alarms);
+  acquisition.begin();
+
+  if (!load_calibration()) {
+    lcd.set_cursor(0,2);
+    lcd.print_P(PSTR("please recalibrate"));
+    tbuf.put_P(PSTR("please recalibrate"));
+    delay(3000);
+  }
 
+  // timer1 runs freely from here on as time base of the scheduler
+  scheduler.start();
+}
+
+void loop() {
+  if (!scheduler.run())
+    scheduler.idle();
 }
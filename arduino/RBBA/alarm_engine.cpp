@@ -0,0 +1,128 @@
+#include <Arduino.h>
+#include "encoder.h"
+#include "motor_control.h"
+#include "diff_pressure.h"
+#include "alarm_engine.h"
+
+AlarmEngine::AlarmEngine(MotorControl &_mc, DiffPressure &_pressure, const int16_t max_pressure_Pa) :
+  mc(_mc),
+  pressure(_pressure),
+  max_pressure(max_pressure_Pa),
+  latched(0),
+  last_sequence(0),
+  last_sample_ms(0),
+  last_position(0),
+  compress_start_position(0),
+  compress_start_pressure(0),
+  compressing(false)
+{
+}
+
+void AlarmEngine::raise(const Alarm alarm)
+{
+  const uint8_t flag = 1 << static_cast<uint8_t>(alarm);
+  if (flag & stop_mask)
+    mc.emergency_stop();
+  // called from interrupts as well, so restore the interrupt flag
+  const uint8_t sreg = SREG;
+  noInterrupts();
+  latched |= flag;
+  SREG = sreg;
+}
+
+void AlarmEngine::set_max_pressure(const int16_t max_pressure_Pa)
+{
+  noInterrupts();
+  max_pressure = max_pressure_Pa;
+  interrupts();
+}
+
+void AlarmEngine::check_control(
+  const uint16_t now_ms,
+  const int16_t  gauge_pressure,
+  const uint8_t  sample_sequence,
+  const bool     motion_checks,
+  const bool     disconnection_check
+)
+{
+  // no new sample for too long, or the bus failed several times in a row
+  if (sample_sequence != last_sequence) {
+    last_sequence  = sample_sequence;
+    last_sample_ms = now_ms;
+  } else if ((uint16_t)(now_ms - last_sample_ms) > sensor_timeout_ms) {
+    raise(Alarm::sensor_failure);
+  }
+  if (pressure.get_failed_polls() >= max_failed_polls)
+    raise(Alarm::sensor_failure);
+
+  if ((motion_checks) && (mc.get_max_encoder() > 0)) {
+    check_end_stops();
+    if (disconnection_check) {
+      check_disconnection(gauge_pressure);
+      return;
+    }
+  }
+  // a compression starts from the current position when enabled again
+  compressing   = false;
+  last_position = mc.get_encoder_value();
+}
+
+// the encoder has to be close to 0 at the opened and close to the
+// calibrated maximum at the closed end stop, and may not run past
+// them without the end stop being pressed
+void AlarmEngine::check_end_stops()
+{
+  const int16_t max_enc   = mc.get_max_encoder();
+  const int16_t tolerance = max_enc >> 4;
+  const uint8_t latch     = mc.get_end_stop_latch();
+  if ((latch & MotorControl::end_stop_opened_flag) &&
+      (abs(mc.get_end_stop_contact(MotorControl::end_stop_opened_flag)) > tolerance))
+    raise(Alarm::end_stop_mismatch);
+  if ((latch & MotorControl::end_stop_closed_flag) &&
+      (abs(mc.get_end_stop_contact(MotorControl::end_stop_closed_flag) - max_enc) > tolerance))
+    raise(Alarm::end_stop_mismatch);
+
+  const int16_t position = mc.get_encoder_value();
+  if (((position < -tolerance) && (!mc.open_end_stop())) ||
+      ((position > max_enc + tolerance) && (!mc.close_end_stop())))
+    raise(Alarm::end_stop_mismatch);
+}
+
+// compressing the bag by a quarter of the range has to raise the pressure
+void AlarmEngine::check_disconnection(const int16_t gauge_pressure)
+{
+  const int16_t position = mc.get_encoder_value();
+  if (position < last_position) {
+    compressing = false;
+  } else if ((!compressing) && (position > last_position)) {
+    compressing             = true;
+    compress_start_position = last_position;
+    compress_start_pressure = gauge_pressure;
+  } else if ((compressing) && (position - compress_start_position > (mc.get_max_encoder() >> 2))) {
+    if (gauge_pressure - compress_start_pressure < min_pressure_rise)
+      raise(Alarm::disconnection);
+    // once per compression
+    compress_start_position = position;
+    compress_start_pressure = gauge_pressure;
+  }
+  last_position = position;
+}
+
+void AlarmEngine::acknowledge()
+{
+  noInterrupts();
+  latched = 0;
+  interrupts();
+  mc.release_emergency_stop();
+  compressing = false;
+}
+
+Alarm AlarmEngine::get_highest() const
+{
+  const uint8_t flags = latched;
+  for (uint8_t i = 0; i < static_cast<uint8_t>(Alarm::nr_of_alarms); ++i) {
+    if (flags & (1 << i))
+      return static_cast<Alarm>(i);
+  }
+  return Alarm::nr_of_alarms;
+}
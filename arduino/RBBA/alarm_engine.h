@@ -0,0 +1,106 @@
+#ifndef ALARM_ENGINE_H
+#define ALARM_ENGINE_H
+
+#include <stdint.h>
+
+class MotorControl;
+class DiffPressure;
+
+/*
+  Latched alarms with a bounded detection latency per class
+
+  The alarms are ordered by priority, highest first. Each one is checked
+  where its latency bound can be kept:
+
+    alarm             | checked in              | worst case latency
+    ------------------+-------------------------+---------------------------
+    over_pressure     | acquisition interrupt   | one sensor sample
+    sensor_failure    | control task            | sensor_timeout_ms + 1 tick
+    end_stop_mismatch | control task            | one control tick
+    disconnection     | control task            | a quarter of the range of
+                      |                         | compression
+
+  over_pressure and end_stop_mismatch stop the motor right where they
+  are detected (see MotorControl::emergency_stop), it stays stopped until
+  the alarms are acknowledged. An alarm stays latched until acknowledge()
+  is called, even if its cause went away. A cause that persists latches
+  it again with the next check.
+*/
+
+enum class Alarm : uint8_t {
+  over_pressure,
+  sensor_failure,
+  end_stop_mismatch,
+  disconnection,
+  nr_of_alarms
+};
+
+class AlarmEngine {
+
+  static const uint8_t  stop_mask         = (1 << static_cast<uint8_t>(Alarm::over_pressure)) |
+                                            (1 << static_cast<uint8_t>(Alarm::end_stop_mismatch));
+  static const uint16_t sensor_timeout_ms = 200;
+  static const uint8_t  max_failed_polls  = 3;
+  static const int16_t  min_pressure_rise = 200; // Pa per quarter of the range
+
+  MotorControl &mc;
+  DiffPressure &pressure;
+
+  int16_t max_pressure;
+
+  volatile uint8_t latched;
+
+  // sensor watchdog
+  uint8_t  last_sequence;
+  uint16_t last_sample_ms;
+
+  // disconnection, pressure at the start of the current compression
+  int16_t  last_position;
+  int16_t  compress_start_position;
+  int16_t  compress_start_pressure;
+  bool     compressing;
+
+public:
+
+  AlarmEngine(MotorControl &_mc, DiffPressure &_pressure, const int16_t max_pressure_Pa);
+
+  // interrupt safe
+  void raise(const Alarm alarm);
+
+  // from the acquisition interrupt, for every sample
+  void check_pressure(const int16_t gauge_pressure) {
+    if (gauge_pressure > max_pressure)
+      raise(Alarm::over_pressure);
+  }
+
+  // e.g., for a calibration against a closed container
+  void set_max_pressure(const int16_t max_pressure_Pa);
+
+  // from the control task, before MotorControl::update() as that clears
+  // the end stop latch, motion checks (end stops and disconnection) are
+  // off during the encoder calibration, the disconnection check also 
+  // during the bag calibrations
+  void check_control(
+    const uint16_t now_ms,
+    const int16_t  gauge_pressure,
+    const uint8_t  sample_sequence,
+    const bool     motion_checks,
+    const bool     disconnection_check
+  );
+
+  // clears all latched alarms and releases the motor
+  void acknowledge();
+
+  uint8_t get_latched() const { return latched; }
+  bool is_latched(const Alarm alarm) const { return latched & (1 << static_cast<uint8_t>(alarm)); }
+  // nr_of_alarms if there is none
+  Alarm get_highest() const;
+
+private:
+
+  void check_end_stops();
+  void check_disconnection(const int16_t gauge_pressure);
+
+};
+
+#endif
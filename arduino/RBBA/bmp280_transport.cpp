@@ -0,0 +1,54 @@
+#include <Arduino.h>
+#include "bmp280_transport.h"
+
+BMP280I2C::BMP280I2C(
+  SoftI2C        &i2c_bus,
+  const uint8_t  address
+) :
+  bus(i2c_bus),
+  slave_addr(address)
+{}
+
+bool BMP280I2C::read_regs(uint8_t reg_addr, uint8_t *data, uint8_t data_size, bool hold_bus)
+{
+  return bus.transceive_wr(slave_addr,&reg_addr,1,data,data_size,hold_bus);
+}
+
+bool BMP280I2C::write_regs(uint8_t *reg_value_pairs, uint8_t data_size, bool hold_bus)
+{
+  return bus.transmit(slave_addr,reg_value_pairs,data_size,hold_bus);
+}
+
+BMP280SPI::BMP280SPI(
+  SoftSPI        &spi_bus,
+  const uint8_t  _cs_pin
+) :
+  bus(spi_bus),
+  cs_pin(_cs_pin)
+{
+  pinMode(cs_pin,OUTPUT);
+  digitalWrite(cs_pin,HIGH);
+}
+
+// bit 7 of the register address selects read (1) or write (0)
+bool BMP280SPI::read_regs(uint8_t reg_addr, uint8_t *data, uint8_t data_size, bool)
+{
+  digitalWrite(cs_pin,LOW);
+  bus.transfer(reg_addr | 0x80);
+  for (uint8_t i = 0; i < data_size; ++i)
+    data[i] = bus.transfer(0);
+  digitalWrite(cs_pin,HIGH);
+  return true;
+}
+
+bool BMP280SPI::write_regs(uint8_t *reg_value_pairs, uint8_t data_size, bool)
+{
+  digitalWrite(cs_pin,LOW);
+  for (uint8_t i = 0; i < data_size; i += 2) {
+    bus.transfer(reg_value_pairs[i] & 0x7F);
+    if (i + 1 < data_size)
+      bus.transfer(reg_value_pairs[i+1]);
+  }
+  digitalWrite(cs_pin,HIGH);
+  return true;
+}
@@ -0,0 +1,62 @@
+#ifndef BMP280_TRANSPORT_H
+#define BMP280_TRANSPORT_H
+
+#include <stdint.h>
+#include "soft_i2c.h"
+#include "soft_spi.h"
+
+/*
+  Register access of the BMP280, independent of the bus it is connected to
+
+  Reads always start at a register address and auto-increment. Writes are
+  register/value pairs, which both the I2C and the SPI interface of the 
+  sensor accept as a burst. hold_bus chains the next transfer on the bus
+  if the transport supports it (see SoftI2C).
+*/
+
+class BMP280Transport {
+public:
+  // all return true if successful
+  virtual bool read_regs(uint8_t reg_addr, uint8_t *data, uint8_t data_size, bool hold_bus) = 0;
+  virtual bool write_regs(uint8_t *reg_value_pairs, uint8_t data_size, bool hold_bus) = 0;
+};
+
+class BMP280I2C : public BMP280Transport {
+
+  SoftI2C &bus; // may be shared with a second sensor on the other slave address
+  const uint8_t slave_addr;
+
+public:
+
+  BMP280I2C(
+    SoftI2C        &i2c_bus,
+    const uint8_t  address  // 0x76 or 0x77, depending on SDO
+  );
+
+  bool read_regs(uint8_t reg_addr, uint8_t *data, uint8_t data_size, bool hold_bus) override;
+  bool write_regs(uint8_t *reg_value_pairs, uint8_t data_size, bool hold_bus) override;
+
+};
+
+// The sensor switches to SPI for good once CSB is pulled low after power-up.
+// SPI has no acknowledge, so a missing sensor is only detected by the
+// chip id check of SoftBMP280::load_calibration and, later on, by the
+// plausibility check of the readings in SoftBMP280::read_sensor_data.
+class BMP280SPI : public BMP280Transport {
+
+  SoftSPI &bus;
+  const uint8_t cs_pin;
+
+public:
+
+  BMP280SPI(
+    SoftSPI        &spi_bus,
+    const uint8_t  _cs_pin
+  );
+
+  bool read_regs(uint8_t reg_addr, uint8_t *data, uint8_t data_size, bool hold_bus) override;
+  bool write_regs(uint8_t *reg_value_pairs, uint8_t data_size, bool hold_bus) override;
+
+};
+
+#endif
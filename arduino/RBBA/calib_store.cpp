@@ -0,0 +1,122 @@
+#include <Arduino.h>
+#include <EEPROM.h>
+#include "calib_store.h"
+
+CalibrationStore::CalibrationStore(EepromWriter &_writer) :
+  writer(_writer),
+  cur_slot(nr_of_slots - 1),
+  store_pending(false)
+{
+  set_defaults();
+}
+
+void CalibrationStore::set_defaults()
+{
+  memset(&record,0,sizeof(record));
+  record.magic   = magic;
+  record.version = version;
+  for (uint8_t i = 0; i < nr_of_profiles; ++i) {
+    strcpy(record.profiles[i].name,"bag 1");
+    record.profiles[i].name[4] += i;
+  }
+}
+
+uint16_t CalibrationStore::crc16(const uint8_t *data, uint16_t size)
+{
+  uint16_t crc = 0xFFFF;
+  while (size--) {
+    crc ^= (uint16_t)*data++ << 8;
+    for (uint8_t b = 0; b < 8; ++b)
+      crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+  }
+  return crc;
+}
+
+bool CalibrationStore::read_slot(const uint8_t slot, Record &r)
+{
+  uint8_t *data = reinterpret_cast<uint8_t*>(&r);
+  const uint16_t addr = slot_addr(slot);
+  for (uint16_t i = 0; i < record_size; ++i)
+    data[i] = EEPROM.read(addr + i);
+  return crc16(data,record_size - 2) == r.crc;
+}
+
+bool CalibrationStore::load()
+{
+  // headers only: magic, version and sequence number of every slot
+  uint16_t sequence[nr_of_slots];
+  uint8_t  candidates = 0; // bit mask of slots with a matching header
+  for (uint8_t s = 0; s < nr_of_slots; ++s) {
+    const uint16_t addr = slot_addr(s);
+    if ((EEPROM.read(addr) != magic) || (EEPROM.read(addr + 1) != version))
+      continue;
+    sequence[s] = EEPROM.read(addr + 2) | ((uint16_t)EEPROM.read(addr + 3) << 8);
+    candidates |= 1 << s;
+  }
+
+  // newest first (sequence numbers may wrap), the crc decides
+  Record r;
+  while (candidates) {
+    uint8_t best = 0xFF;
+    for (uint8_t s = 0; s < nr_of_slots; ++s) {
+      if (!(candidates & (1 << s)))
+        continue;
+      if ((best == 0xFF) || ((int16_t)(sequence[s] - sequence[best]) > 0))
+        best = s;
+    }
+    candidates &= ~(1 << best);
+    if ((read_slot(best,r)) && (r.active_profile < nr_of_profiles)) {
+      record   = r;
+      cur_slot = best;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool CalibrationStore::load_legacy(int16_t &max_encoder, uint16_t *volumes)
+{
+  EEPROM.get(0,max_encoder);
+  // erased cells read 0xFF, i.e., -1
+  if (max_encoder <= 0)
+    return false;
+  bool plausible = false;
+  for (uint8_t i = 0; i < legacy_nr_of_volumes; ++i) {
+    EEPROM.get(2 + i * 2,volumes[i]);
+    if (volumes[i] > legacy_max_volume) {
+      memset(volumes,0,legacy_nr_of_volumes * sizeof(uint16_t));
+      return true;
+    }
+    if (volumes[i])
+      plausible = true;
+  }
+  if (!plausible)
+    memset(volumes,0,legacy_nr_of_volumes * sizeof(uint16_t));
+  return true;
+}
+
+void CalibrationStore::store()
+{
+  if (writer.is_done())
+    start_store();
+  else
+    store_pending = true;
+}
+
+void CalibrationStore::update()
+{
+  if ((store_pending) && (writer.is_done())) {
+    store_pending = false;
+    start_store();
+  }
+}
+
+void CalibrationStore::start_store()
+{
+  ++record.sequence;
+  record.magic   = magic;
+  record.version = version;
+  record.crc     = crc16(reinterpret_cast<const uint8_t*>(&record),record_size - 2);
+  cur_slot = (cur_slot + 1) % nr_of_slots;
+  writer.write(slot_addr(cur_slot),&record,record_size);
+}
@@ -0,0 +1,110 @@
+#ifndef CALIB_STORE_H
+#define CALIB_STORE_H
+
+#include <stdint.h>
+#include "eeprom_writer.h"
+
+/*
+  Calibration data in the EEPROM
+
+  The calibration is kept as one record that holds the motor encoder 
+  range and the volume calibration of several bag (resuscitator) 
+  profiles, so switching bags does not require a new calibration.
+
+  The EEPROM is split into nr_of_slots slots of one record each. Every
+  store goes to the slot after the one of the current record, which 
+  spreads the wear over all slots. Records carry a magic byte, the 
+  format version, a sequence number that increments with every store,
+  and a CRC-16 (CCITT) over everything before it. load() scans only the
+  headers of all slots and checks the CRC of the newest candidate, 
+  falling back to older ones if it is broken (e.g., power loss while 
+  writing). A blank or foreign EEPROM yields no valid record.
+
+  Stores are written in the background by the EepromWriter, straight
+  from the record. A store while a write is running is deferred until 
+  update() finds the writer idle. Changing the record during a write may
+  corrupt that slot, which is fine, as the change is followed by a store
+  into the next slot and load() skips the broken one.
+*/
+
+class CalibrationStore {
+
+public:
+
+  static const uint8_t nr_of_profiles  = 4;
+  static const uint8_t nr_of_vol_points = 16;
+  static const uint8_t name_size       = 8; // incl. terminating zero
+
+  struct BagProfile {
+    char     name[name_size];
+    uint16_t volume[nr_of_vol_points]; // ml at 1/16, 2/16, ... 16/16 of the motor range
+  };
+
+  struct Record {
+    uint8_t    magic;
+    uint8_t    version;
+    uint16_t   sequence;
+    int16_t    max_encoder;
+    uint8_t    active_profile;
+    uint8_t    reserved;
+    BagProfile profiles[nr_of_profiles];
+    uint16_t   crc;
+  };
+
+  static const uint8_t  magic       = 0xB5;
+  static const uint8_t  version     = 2;
+  static const uint16_t record_size = sizeof(Record);
+  static const uint8_t  nr_of_slots = 1024 / sizeof(Record);
+
+  static const uint8_t  legacy_nr_of_volumes = 9;
+  static const uint16_t legacy_max_volume    = 1000; // ml, limit of the manual entry
+
+  static_assert(nr_of_slots <= 8, "the slot scan uses an 8 bit mask");
+  static_assert(record_size < 256, "the EepromWriter writes up to 255 bytes per job");
+
+private:
+
+  EepromWriter &writer;
+
+  Record  record;
+  uint8_t cur_slot;
+  bool    store_pending;
+
+public:
+
+  CalibrationStore(EepromWriter &_writer);
+
+  // loads the newest valid record, returns false if there is none (the 
+  // defaults are kept then, see set_defaults)
+  bool load();
+  // the layout of the firmware before the records: the max. encoder value
+  // (int16) at 0 and the 9 volumes (uint16) of the manual bag calibration
+  // (20% to 100% of the range) from 2 on, meant to be imported once if
+  // load() fails, returns false if there is no plausible encoder value,
+  // the volumes are all 0 if they are not plausible
+  bool load_legacy(int16_t &max_encoder, uint16_t *volumes);
+  // writes the record into the next slot, in the background
+  void store();
+  // starts a deferred store, call it periodically
+  void update();
+  // true while a store is pending or being written
+  bool is_busy() const { return (store_pending) || (!writer.is_done()); }
+
+  // all volumes zero, profiles named "bag 1" to "bag N"
+  void set_defaults();
+
+  Record& get_record() { return record; }
+  BagProfile& get_active_profile() { return record.profiles[record.active_profile]; }
+  void select_profile(const uint8_t i) { if (i < nr_of_profiles) record.active_profile = i; }
+
+  static uint16_t crc16(const uint8_t *data, uint16_t size);
+
+private:
+
+  static uint16_t slot_addr(const uint8_t slot) { return (uint16_t)slot * record_size; }
+  bool read_slot(const uint8_t slot, Record &r);
+  void start_store();
+
+};
+
+#endif
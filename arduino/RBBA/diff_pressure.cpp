@@ -0,0 +1,86 @@
+#include <Arduino.h>
+#include "diff_pressure.h"
+
+DiffPressure::DiffPressure(SoftBMP280 &_patient, SoftBMP280 &_ambient) :
+  patient(_patient),
+  ambient(_ambient),
+  ambient_present(false),
+  offset(0),
+  gauge_pressure(0),
+  bus_errors(0),
+  failed_polls(0)
+{}
+
+bool DiffPressure::load_calibration()
+{
+  ambient_present = ambient.load_calibration();
+  return patient.load_calibration();
+}
+
+void DiffPressure::start_acquisition()
+{
+  patient.start_acquisition();
+  if (ambient_present)
+    ambient.start_acquisition();
+}
+
+int32_t DiffPressure::raw_difference() const
+{
+  int32_t result = (int32_t)patient.get_latest_pressure();
+  if (ambient_present)
+    result -= (int32_t)ambient.get_latest_pressure();
+  return result;
+}
+
+bool DiffPressure::poll_sensor_data()
+{
+  if (!patient.conversion_complete())
+    return false;
+
+  // the ambient conversion was triggered right after the patient one, 
+  // so it is complete by the time the patient sensor has been read
+  // a failed read leaves the old data in place, so it must not 
+  // be combined with fresh data of the other sensor
+  uint8_t errors = 0;
+  if (!patient.read_sensor_data(ambient_present))
+    ++errors;
+  if ((ambient_present) && (!ambient.read_sensor_data()))
+    ++errors;
+  if (!patient.trigger_conversion(ambient_present))
+    ++errors;
+  if ((ambient_present) && (!ambient.trigger_conversion()))
+    ++errors;
+
+  if (errors) {
+    bus_errors = bus_errors > 255 - errors ? 255 : bus_errors + errors;
+    if (failed_polls < 255)
+      ++failed_polls;
+    return false;
+  }
+  failed_polls = 0;
+
+  bool result = patient.is_latest_valid();
+  if (ambient_present)
+    result = result && ambient.is_latest_valid();
+  if (result)
+    gauge_pressure = raw_difference() - offset;
+  return result;
+}
+
+bool DiffPressure::apply_profile(const SoftBMP280::Profile &profile)
+{
+  // a switch discards the samples until the filter settled, don't
+  // pay for that if nothing changes
+  if (patient.uses_profile(profile) && ((!ambient_present) || ambient.uses_profile(profile)))
+    return false;
+  patient.apply_profile(profile,ambient_present);
+  if (ambient_present)
+    ambient.apply_profile(profile);
+  return true;
+}
+
+void DiffPressure::zero()
+{
+  offset = raw_difference();
+  gauge_pressure = 0;
+}
@@ -0,0 +1,67 @@
+#ifndef DIFF_PRESSURE_H
+#define DIFF_PRESSURE_H
+
+#include <stdint.h>
+#include "soft_bmp280.h"
+
+/*
+  Gauge pressure from two BMP280 sensors on the same bus
+
+  One sensor measures the patient side, the other one the ambient
+  pressure. Both conversions are triggered and read back-to-back, 
+  chained by repeated starts on the shared bus. The gauge pressure is 
+  the difference of both, corrected by the offset between the two 
+  sensors that is determined with zero() while both see ambient pressure.
+  If the ambient sensor is missing, the gauge pressure falls back to 
+  the difference to the patient side pressure at the time of zero().
+*/
+
+class DiffPressure {
+
+  SoftBMP280 &patient;
+  SoftBMP280 &ambient;
+
+  bool ambient_present;
+
+  int32_t offset;
+  int32_t gauge_pressure;
+
+  // bus transfers that failed, in total (saturating) and polls in a row
+  uint8_t bus_errors;
+  uint8_t failed_polls;
+
+public:
+
+  DiffPressure(SoftBMP280 &_patient, SoftBMP280 &_ambient);
+
+  // loads the calibration of both sensors, returns false if the patient side sensor fails
+  bool load_calibration();
+
+  void start_acquisition();
+  bool poll_sensor_data(); // returns true if a new (valid) sample was read
+
+  // applies the profile to both sensors, so their conversions stay aligned,
+  // returns false if both already use it, the acquisition then goes on
+  bool apply_profile(const SoftBMP280::Profile &profile);
+
+  void zero();
+
+  bool has_ambient() const { return ambient_present; }
+
+  uint8_t get_bus_errors() const { return bus_errors; }
+  uint8_t get_failed_polls() const { return failed_polls; }
+
+  int32_t  get_gauge_pressure() const { return gauge_pressure; } // Pa
+  uint32_t get_ambient_pressure() const { return ambient.get_latest_pressure(); }
+  uint32_t get_latest_timestamp() const { return patient.get_latest_timestamp(); }
+
+  SoftBMP280& get_patient_sensor() { return patient; }
+  SoftBMP280& get_ambient_sensor() { return ambient; }
+
+private:
+
+  int32_t raw_difference() const;
+
+};
+
+#endif
@@ -0,0 +1,55 @@
+#include <Arduino.h>
+#include "eeprom_writer.h"
+
+EepromWriter::EepromWriter() :
+  queue_head(0),
+  queue_tail(0),
+  pos(0)
+{
+}
+
+bool EepromWriter::write(const uint16_t addr, const void *data, const uint8_t size)
+{
+  const uint8_t next = (queue_head + 1) & (queue_size - 1);
+  if (next == queue_tail)
+    return false;
+  Job &job = queue[queue_head];
+  job.addr = addr;
+  job.data = static_cast<const uint8_t*>(data);
+  job.size = size;
+  queue_head = next;
+  // fires right away if the EEPROM is idle
+  EECR |= _BV(EERIE);
+  return true;
+}
+
+void EepromWriter::isr()
+{
+  // EEPE is clear in here, so reading and programming need no waiting,
+  // skipping is bounded to keep the interrupt short, it fires again 
+  // right away anyway
+  uint8_t budget = max_skip;
+  while ((queue_tail != queue_head) && (budget--)) {
+    const Job &job = queue[queue_tail];
+    if (pos >= job.size) {
+      pos = 0;
+      queue_tail = (queue_tail + 1) & (queue_size - 1);
+      continue;
+    }
+    const uint16_t addr  = job.addr + pos;
+    const uint8_t  value = job.data[pos];
+    ++pos;
+    EEAR = addr;
+    EECR |= _BV(EERE);
+    if (EEDR == value)
+      continue;
+    // erase + write, EEPE has to follow EEMPE within 4 cycles,
+    // interrupts are disabled in here
+    EEDR = value;
+    EECR = _BV(EEMPE) | _BV(EERIE);
+    EECR |= _BV(EEPE);
+    return;
+  }
+  if (queue_tail == queue_head)
+    EECR &= ~_BV(EERIE);
+}
@@ -0,0 +1,51 @@
+#ifndef EEPROM_WRITER_H
+#define EEPROM_WRITER_H
+
+#include <stdint.h>
+
+/*
+  Non blocking EEPROM writes
+
+  Programming one EEPROM byte takes ~3.4ms, EEPROM.put / update busy waits
+  for that. Here, writes are queued as jobs (address + source buffer) and
+  isr() is meant to be called from the EE_READY interrupt, which fires
+  whenever the EEPROM is idle. Each call programs the next byte that
+  differs from the EEPROM content and returns, bytes that are equal are
+  skipped. Once the queue is empty, the interrupt disables itself.
+
+  The source buffers are not copied, they have to stay valid (and should
+  stay unchanged) until is_done() returns true.
+*/
+
+class EepromWriter {
+
+  static const uint8_t queue_size = 4;
+  static const uint8_t max_skip   = 16; // equal bytes per call
+
+  struct Job {
+    uint16_t addr;
+    const uint8_t *data;
+    uint8_t size;
+  };
+
+  Job queue[queue_size];
+  volatile uint8_t queue_head;
+  volatile uint8_t queue_tail;
+  // progress within the job at queue_tail
+  uint8_t pos;
+
+public:
+
+  EepromWriter();
+
+  // queues size bytes from data to be written at addr,
+  // returns false if the queue is full
+  bool write(const uint16_t addr, const void *data, const uint8_t size);
+
+  void isr();
+
+  bool is_done() const { return queue_head == queue_tail; }
+
+};
+
+#endif
@@ -28,6 +28,12 @@ void Encoder::set_value(int16_t value) {
   interrupts();
 }
 
+void Encoder::add_offset(int16_t offset) {
+  noInterrupts();
+  encoder_value += offset;
+  interrupts();
+}
+
 int16_t Encoder::get_value() {
   noInterrupts();
   int16_t result = encoder_value;
@@ -18,7 +18,12 @@ public:
 
   void set_value(int16_t value);
 
+  void add_offset(int16_t offset);
+
   int16_t get_value();
+
+  // only call this with interrupts disabled, e.g., from within an ISR
+  int16_t get_value_isr() const { return encoder_value; }
   
 };
 
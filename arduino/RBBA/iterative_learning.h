@@ -0,0 +1,101 @@
+#ifndef ITERATIVE_LEARNING_H
+#define ITERATIVE_LEARNING_H
+
+#include <stdint.h>
+#include <string.h>
+
+/*
+  Iterative learning control for repetitive motions
+
+  Each breath repeats the same motion, hence the tracking error repeats, too.
+  The cycle is split into Bins bins of TicksPerBin control ticks each. While
+  a cycle runs, the position error of each bin is accumulated and used to
+  update the correction of the preceding bin (one bin lead, as the plant
+  reacts with a delay). The corrections are applied as an additional speed
+  set point in the next cycle. To keep things stable the error is averaged
+  with the one of the previous bin and the corrections slowly leak towards
+  zero: by 1/32 per cycle, and by at least one count every leak_period
+  cycles, so small corrections decay, too. Everything is updated in place,
+  so RAM usage is one byte per bin.
+*/
+
+template<uint8_t Bins, uint8_t TicksPerBin>
+class IterativeLearning {
+
+  static const uint8_t gain_shift = 4; // learning gain of 1/16 per cycle on the error sum of two bins
+  static const uint8_t leak_shift  = 5; // corrections lose 1/32 per cycle
+  static const uint8_t leak_period = 4; // and at least one count every 4 cycles, power of 2
+
+  int8_t correction[Bins];
+
+  int16_t err_sum;
+  int16_t prev_err_sum;
+
+  uint8_t bin;
+  uint8_t bin_tick;
+  uint8_t cycle_cnt;
+
+public:
+
+  // correction units in encoder ticks per second
+  static const int8_t correction_scale = 4;
+
+  IterativeLearning() :
+    err_sum(0),
+    prev_err_sum(0),
+    bin(Bins),
+    bin_tick(0),
+    cycle_cnt(0)
+  {
+    reset();
+  }
+
+  void reset() {
+    memset(correction,0,Bins);
+  }
+
+  void start_cycle() {
+    bin          = 0;
+    bin_tick     = 0;
+    err_sum      = 0;
+    prev_err_sum = 0;
+    ++cycle_cnt;
+  }
+
+  // records the position error of this tick and returns the
+  // speed correction (encoder ticks per second) to apply
+  int16_t update(const int16_t position_error) {
+    if (bin >= Bins)
+      return 0;
+
+    int16_t e = position_error;
+    if (e >  1023) e =  1023;
+    if (e < -1023) e = -1023;
+    err_sum += e;
+
+    const int16_t result = (int16_t)correction[bin] * (int16_t)correction_scale;
+
+    if (++bin_tick == TicksPerBin) {
+      if (bin > 0) {
+        int16_t c = correction[bin-1];
+        int16_t leak = c / (int16_t)(1 << leak_shift);
+        if ((leak == 0) && ((cycle_cnt & (leak_period - 1)) == 0))
+          leak = (c > 0) - (c < 0);
+        c -= leak;
+        c += (err_sum + prev_err_sum) >> gain_shift;
+        if (c >  127) c =  127;
+        if (c < -127) c = -127;
+        correction[bin-1] = (int8_t)c;
+      }
+      prev_err_sum = err_sum;
+      err_sum      = 0;
+      bin_tick     = 0;
+      ++bin;
+    }
+
+    return result;
+  }
+
+};
+
+#endif
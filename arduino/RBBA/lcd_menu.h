@@ -135,6 +135,29 @@ struct LCDMenuTextElement : public LCDMenuElement<E> {
 
 };
 
+// like LCDMenuTextElement, for text in flash (PROGMEM)
+template<typename E>
+struct LCDMenuFlashTextElement : public LCDMenuElement<E> {
+
+  const char *text;
+
+  LCDMenuFlashTextElement(const uint8_t x, const uint8_t y, const char *_text, OnPushFunc<E> _on_push = nullptr) :
+    LCDMenuElement<E>(x,y),
+    text(_text)
+  {
+    LCDMenuElement<E>::set_draw([](LCDMenuBase<E> *menu, LCDMenuElement<E> *element) {
+      menu->get_display().print_P(static_cast<LCDMenuFlashTextElement*>(element)->text);
+    });
+    LCDMenuElement<E>::set_push(_on_push);
+  }
+
+  LCDMenuFlashTextElement(const LCDMenuFlashTextElement<E> &other) :
+    LCDMenuElement<E>(other),
+    text(other.text)
+  {}
+
+};
+
 template<typename E>
 struct LCDMenuBufferElement : public LCDMenuElement<E> {
 
@@ -1,6 +1,7 @@
 #include <Arduino.h>
 #include "encoder.h"
 #include "motor_control.h"
+#include "volume_curve.h"
 
 MotorControl::MotorControl(    
   const uint8_t   en_pin, 
@@ -16,6 +17,10 @@ MotorControl::MotorControl(
   motor_direction_pin_B(dir_pin_B),
   end_stop_opened_pin(es_opened_pin),
   end_stop_closed_pin(es_closed_pin),
+  end_stop_opened_reg(portInputRegister(digitalPinToPort(es_opened_pin))),
+  end_stop_closed_reg(portInputRegister(digitalPinToPort(es_closed_pin))),
+  end_stop_opened_mask(digitalPinToBitMask(es_opened_pin)),
+  end_stop_closed_mask(digitalPinToBitMask(es_closed_pin)),
   update_interval_uS(upd_interval_uS),
   encoder(enc),
   last_encoder_value(0),
@@ -25,7 +30,18 @@ MotorControl::MotorControl(
   set_position(0),
   max_speed(0),
   max_enc_value(0),
-  raw_mode(false)
+  ref_position(0),
+  ref_step(0),
+  raw_mode(false),
+  volume_curve(nullptr),
+  set_flow(0),
+  ref_step_scale(((int32_t)upd_interval_uS << 16) / (int32_t)1000000),
+  ilc(),
+  learning(false),
+  end_stop_state(0),
+  end_stop_latch(0),
+  end_stop_contact_enc{0,0},
+  stopped(false)
 {
   pinMode(motor_enable_pin,OUTPUT);
   digitalWrite(motor_enable_pin,LOW);
@@ -47,6 +63,91 @@ MotorControl::MotorControl(
 #endif    
 }
 
+void MotorControl::enable_end_stop_interrupts()
+{
+  end_stop_state = (open_end_stop()  ? end_stop_opened_flag : 0) |
+                   (close_end_stop() ? end_stop_closed_flag : 0);
+  *digitalPinToPCMSK(end_stop_opened_pin) |= 1 << digitalPinToPCMSKbit(end_stop_opened_pin);
+  *digitalPinToPCMSK(end_stop_closed_pin) |= 1 << digitalPinToPCMSKbit(end_stop_closed_pin);
+  *digitalPinToPCICR(end_stop_opened_pin) |= 1 << digitalPinToPCICRbit(end_stop_opened_pin);
+  *digitalPinToPCICR(end_stop_closed_pin) |= 1 << digitalPinToPCICRbit(end_stop_closed_pin);
+}
+
+// called on every pin change of the end switches; if a switch closes
+// while the motor is driving towards it, the motor is cut off right here
+// and the event is latched for the control loop
+void MotorControl::end_stop_isr()
+{
+  const uint8_t state = (open_end_stop()  ? end_stop_opened_flag : 0) |
+                        (close_end_stop() ? end_stop_closed_flag : 0);
+  const uint8_t contact = state & ~end_stop_state;
+  end_stop_state = state;
+  if (!contact)
+    return;
+
+  const int16_t enc = encoder.get_value_isr();
+  // direction 0 moves towards the opened end stop, direction 1 towards the closed one
+  if (contact & end_stop_opened_flag) {
+    end_stop_contact_enc[0] = enc;
+    if (cur_dir == 0)
+      set_pwm(0);
+  }
+  if (contact & end_stop_closed_flag) {
+    end_stop_contact_enc[1] = enc;
+    if (cur_dir == 1)
+      set_pwm(0);
+  }
+  end_stop_latch |= contact;
+}
+
+void MotorControl::clear_end_stop_latch(const uint8_t flags)
+{
+  noInterrupts();
+  end_stop_latch &= ~flags;
+  interrupts();
+}
+
+int16_t MotorControl::get_end_stop_contact(const uint8_t flag) const
+{
+  noInterrupts();
+  const int16_t contact = end_stop_contact_enc[(flag & end_stop_closed_flag) ? 1 : 0];
+  interrupts();
+  return contact * (int16_t)encoder_reversal;
+}
+
+void MotorControl::emergency_stop()
+{
+  stopped = true;
+  set_pwm(0);
+}
+
+void MotorControl::release_emergency_stop()
+{
+  // restart the speed controller from standstill
+  noInterrupts();
+  stopped = false;
+  cur_PWM = 0;
+  interrupts();
+}
+
+void MotorControl::zero_enc_at_end_stop()
+{
+  noInterrupts();
+  const int16_t offset = end_stop_contact_enc[0];
+  end_stop_contact_enc[0]  = 0;
+  end_stop_contact_enc[1] -= offset;
+  interrupts();
+  encoder.add_offset(-offset);
+}
+
+void MotorControl::max_enc_at_end_stop()
+{
+  noInterrupts();
+  const int16_t contact = end_stop_contact_enc[1];
+  interrupts();
+  max_enc_value = contact * (int16_t)encoder_reversal;
+}
+
 void MotorControl::set_pwm(const uint8_t pwm)
 {
 #ifdef USE_TIMER2_OC2B    
@@ -72,8 +173,10 @@ void MotorControl::set_direction(const uint8_t dir)
 void MotorControl::move_raw(const uint8_t pwm, const uint8_t dir)
 {
   raw_mode = true;
+  set_flow = 0;
   set_direction(dir);
-  set_pwm(pwm);
+  if (!stopped)
+    set_pwm(pwm);
 }
 
 uint8_t MotorControl::get_direction() const
@@ -92,68 +195,143 @@ void MotorControl::hard_stop()
 
 void MotorControl::home()
 {
-  if (digitalRead(end_stop_opened_pin) == LOW) {
+  if (open_end_stop()) {
     set_direction(1);
     set_pwm(home_PWM);
-    while (digitalRead(end_stop_opened_pin) == LOW);
+    while (open_end_stop());
     delay(200);
   }
+  clear_end_stop_latch(end_stop_opened_flag);
   set_direction(0);
   set_pwm(home_PWM);
-  while (digitalRead(end_stop_opened_pin));
+  while (!(end_stop_latch & end_stop_opened_flag) && !open_end_stop());
   hard_stop();
-  encoder.set_value(0);    
-  last_encoder_value = 0;
+  zero_enc_at_end_stop();
+  last_encoder_value = encoder.get_value() * (int16_t)encoder_reversal;
 }
 
 void MotorControl::calibrate()
 {
-  if (digitalRead(end_stop_opened_pin) == LOW) {
-    set_direction(1);
-    set_pwm(home_PWM);
-    while (digitalRead(end_stop_opened_pin) == LOW);
-    delay(200);
-  }
-  set_direction(0);
-  set_pwm(home_PWM);
-  while (digitalRead(end_stop_opened_pin));
-  hard_stop();
-  encoder.set_value(0);
-  last_encoder_value = 0;
+  home();
+  clear_end_stop_latch(end_stop_closed_flag);
   set_direction(1);
   set_pwm(home_PWM);
-  while (digitalRead(end_stop_closed_pin));
+  while (!(end_stop_latch & end_stop_closed_flag) && !close_end_stop());
   hard_stop();
-  max_enc_value = encoder.get_value() * (int16_t)encoder_reversal;
-  last_encoder_value = max_enc_value;
+  max_enc_at_end_stop();
+  last_encoder_value = encoder.get_value() * (int16_t)encoder_reversal;
+}
+
+void MotorControl::set_reference(const int16_t cur_position)
+{
+  ref_position = (int32_t)cur_position << 8;
+  ref_step     = ((int32_t)max_speed << 8) / ((int32_t)1000000 / (int32_t)update_interval_uS);
 }
 
 void MotorControl::move_const_time(const uint8_t pos, const uint16_t duration_mS)
 {
-  set_position         = (int32_t)max_enc_value * (int32_t)pos / (int32_t)100;
+  set_flow = 0;
+  move_to_const_time((int32_t)max_enc_value * (int32_t)pos / (int32_t)100,duration_mS);
+}
+
+bool MotorControl::move_volume_const_time(const uint16_t ml, const uint16_t duration_mS)
+{
+  if ((volume_curve == nullptr) || (!volume_curve->is_valid()))
+    return false;
+  set_flow = 0;
+  move_to_const_time(volume_curve->volume_to_position(ml),duration_mS);
+  return true;
+}
+
+bool MotorControl::move_volume_const_flow(const uint16_t ml, const uint16_t ml_per_s)
+{
+  if ((volume_curve == nullptr) || (!volume_curve->is_valid()) || (ml_per_s == 0))
+    return false;
+  set_position = volume_curve->volume_to_position(ml);
+  set_flow     = ml_per_s;
+  update_flow_speed(encoder.get_value() * (int16_t)encoder_reversal);
+  set_reference(encoder.get_value() * (int16_t)encoder_reversal);
+  return true;
+}
+
+void MotorControl::update_flow_speed(const int16_t cur_position)
+{
+  // capped at the full range per second, like move_const_speed
+  uint16_t speed = volume_curve->flow_to_speed(cur_position,set_flow);
+  if (speed > (uint16_t)max_enc_value)
+    speed = max_enc_value;
+  max_speed = speed;
+  ref_step  = ((int32_t)max_speed * ref_step_scale) >> 8;
+}
+
+uint16_t MotorControl::get_volume()
+{
+  if (volume_curve == nullptr)
+    return 0;
+  return volume_curve->position_to_volume(encoder.get_value() * (int16_t)encoder_reversal);
+}
+
+void MotorControl::move_to_const_time(const int16_t position, const uint16_t duration_mS)
+{
+  set_position         = position;
   int16_t cur_position = encoder.get_value() * (int16_t)encoder_reversal;
   max_speed            = (int32_t)abs(set_position - cur_position) * (int32_t)1000 / (int32_t)duration_mS;
+  set_reference(cur_position);
 }
 
 void MotorControl::move_const_speed(const uint8_t pos, const uint8_t speed)
 {
+  set_flow             = 0;
   set_position         = (int32_t)max_enc_value * (int32_t)pos / (int32_t)100;
   max_speed            = (int32_t)max_enc_value * (int32_t)speed / (int32_t)100;
+  set_reference(encoder.get_value() * (int16_t)encoder_reversal);
 }
 
 void MotorControl::update() 
 {
+  if (end_stop_latch) {
+    // the ISR already cut the motor, so restart the speed
+    // controller from standstill instead of pushing on
+    noInterrupts();
+    end_stop_latch = 0;
+    interrupts();
+    if (!raw_mode)
+      cur_PWM = 0;
+  }
   if (raw_mode)
     return;
   // position control section
   int16_t cur_enc_value = encoder.get_value() * (int16_t)encoder_reversal;
   int16_t cur_delta = set_position - cur_enc_value;
 
-  if (abs(cur_delta) < position_epsilon) {
+  const bool at_position = abs(cur_delta) < position_epsilon;
+  if (at_position) {
     cur_delta = 0;
   }
 
+  if (set_flow)
+    update_flow_speed(cur_enc_value);
+
   set_speed = cur_delta * position_p;
+
+  // learning section, corrects the speed set point by what was
+  // learned from the tracking error at this point of the last cycles
+  const int32_t set_ref = (int32_t)set_position << 8;
+  if (ref_position < set_ref) {
+    ref_position += ref_step;
+    if (ref_position > set_ref) ref_position = set_ref;
+  } else {
+    ref_position -= ref_step;
+    if (ref_position < set_ref) ref_position = set_ref;
+  }
+  if (learning) {
+    // always recorded to keep the bins in step, but not applied
+    // in the deadband, so the motor rests at the set position
+    const int16_t correction = ilc.update((int16_t)(ref_position >> 8) - cur_enc_value);
+    if (!at_position)
+      set_speed += correction;
+  }
+  // the correction may not exceed the speed limit of the move
   if (set_speed >  max_speed) set_speed =  max_speed;
   if (set_speed < -max_speed) set_speed = -max_speed;
   
@@ -179,8 +357,12 @@ void MotorControl::update()
   }
 
   uint8_t pwm_out = abs(cur_PWM / k);
-  if (((set_speed < 0) && (digitalRead(end_stop_opened_pin) == LOW)) ||
-      ((set_speed > 0) && (digitalRead(end_stop_closed_pin) == LOW)) ||
+  // no interrupts in between the end stop check and setting the pwm, 
+  // otherwise we might override a cut-off made by end_stop_isr
+  noInterrupts();
+  if ((stopped) ||
+      ((set_speed < 0) && open_end_stop()) ||
+      ((set_speed > 0) && close_end_stop()) ||
       (pwm_out < PWM_epsilon) ||
       (set_speed == 0))
   {
@@ -188,6 +370,7 @@ void MotorControl::update()
   } else {
     set_pwm(pwm_out);
   }
+  interrupts();
 
   last_encoder_value = cur_enc_value;
 }
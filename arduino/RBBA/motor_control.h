@@ -3,10 +3,12 @@
 
 #include <stdint.h>
 #include "text_buffer.h"
+#include "iterative_learning.h"
 
 #define USE_TIMER2_OC2B
 
 class Encoder;
+class VolumeCurve;
 
 class MotorControl {
 
@@ -24,6 +26,12 @@ const uint8_t motor_direction_pin_B;
 const uint8_t end_stop_opened_pin;
 const uint8_t end_stop_closed_pin;
 
+// direct port access to the end switches, digitalRead is too slow for the ISR
+volatile uint8_t *const end_stop_opened_reg;
+volatile uint8_t *const end_stop_closed_reg;
+const uint8_t end_stop_opened_mask;
+const uint8_t end_stop_closed_mask;
+
 const uint16_t update_interval_uS;
 
 Encoder &encoder;
@@ -31,17 +39,43 @@ Encoder &encoder;
 int16_t last_encoder_value;
 int16_t set_speed;
 int16_t cur_PWM;
-uint8_t cur_dir;
+volatile uint8_t cur_dir;
 
 int16_t  set_position;
 int16_t  max_speed;
 int16_t  max_enc_value;
 
+// reference trajectory (8 fractional bits) ramping towards set_position with max_speed
+int32_t  ref_position;
+int32_t  ref_step;
+
 bool raw_mode;
 
+// optional, for moves by volume
+const VolumeCurve *volume_curve;
+// flow control, max_speed follows the flow at the current position (0 = off)
+uint16_t set_flow;
+// ref_step per max_speed, 16 fractional bits
+int32_t  ref_step_scale;
+
+// learned speed corrections over a breath, 64 bins a 4 ticks (~5s @ 20ms)
+IterativeLearning<64,4> ilc;
+bool learning;
+
+// end switch events latched by end_stop_isr
+volatile uint8_t end_stop_state;
+volatile uint8_t end_stop_latch;
+volatile int16_t end_stop_contact_enc[2]; // raw encoder value at contact, [0] opened, [1] closed
+
+// set by emergency_stop, the motor stays off until released
+volatile bool stopped;
+
 public:
   const uint8_t home_PWM = 100;
 
+  static const uint8_t end_stop_opened_flag = 1;
+  static const uint8_t end_stop_closed_flag = 2;
+
   MotorControl(
     const uint8_t   en_pin, 
     const uint8_t   dir_pin_A, 
@@ -63,22 +97,61 @@ public:
   void move_const_time(const uint8_t pos, const uint16_t duration_mS);
   void move_const_speed(const uint8_t pos, const uint8_t speed);
 
+  // moves to the position that displaces ml, false without a valid curve
+  bool move_volume_const_time(const uint16_t ml, const uint16_t duration_mS);
+  // same, but with a constant flow of ml_per_s, the speed set point follows
+  // the slope of the volume curve, every other move ends the flow control
+  bool move_volume_const_flow(const uint16_t ml, const uint16_t ml_per_s);
+  // displaced volume at the current position, 0 without a valid curve
+  uint16_t get_volume();
+  void set_volume_curve(const VolumeCurve *curve) { volume_curve = curve; }
+
+  // marks the start of a repetitive motion cycle (a breath) for the learning layer
+  void start_cycle() { ilc.start_cycle(); }
+  void set_learning(const bool on) { learning = on; }
+  void reset_learning() { ilc.reset(); }
+
   int16_t get_max_encoder() const;
   void set_max_encoder(const int16_t value);
 
-  bool open_end_stop()  { return (digitalRead(end_stop_opened_pin) == LOW); } 
-  bool close_end_stop() { return (digitalRead(end_stop_closed_pin) == LOW); } 
+  bool open_end_stop()  { return (*end_stop_opened_reg & end_stop_opened_mask) == 0; } 
+  bool close_end_stop() { return (*end_stop_closed_reg & end_stop_closed_mask) == 0; } 
+
+  // the end switches need to be on pin change interrupt capable pins and 
+  // end_stop_isr has to be called from the respective PCINTx_vect ISRs
+  void enable_end_stop_interrupts();
+  void end_stop_isr();
+
+  uint8_t get_end_stop_latch() const { return end_stop_latch; }
+  void clear_end_stop_latch(const uint8_t flags);
+  // encoder value at the last contact of the end stop given by its flag
+  int16_t get_end_stop_contact(const uint8_t flag) const;
+
+  // cuts the motor and keeps it off, interrupt safe (see AlarmEngine)
+  void emergency_stop();
+  void release_emergency_stop();
+  bool is_emergency_stopped() const { return stopped; }
 
   void move_raw(const uint8_t pwm, const uint8_t dir);
   void zero_enc() { encoder.set_value(0); }
   void max_enc() { max_enc_value = encoder.get_value() * (int16_t)encoder_reversal; }
 
+  // same as above, but relative to the encoder value latched at the moment of contact
+  void zero_enc_at_end_stop();
+  void max_enc_at_end_stop();
+
   int16_t get_encoder_value() { return encoder.get_value() * (int16_t)encoder_reversal; }
+  int16_t get_set_position() const { return set_position; }
+  int16_t get_pwm() const { return cur_PWM; }
 
 private:
 
   void set_pwm(const uint8_t pwm);
 
+  void set_reference(const int16_t cur_position);
+  void move_to_const_time(const int16_t position, const uint16_t duration_mS);
+  void update_flow_speed(const int16_t cur_position);
+
   void    set_direction(const uint8_t dir);
   uint8_t get_direction() const;
   
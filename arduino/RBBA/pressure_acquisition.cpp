@@ -0,0 +1,114 @@
+#include <Arduino.h>
+#include "pressure_acquisition.h"
+
+PressureAcquisition::PressureAcquisition(DiffPressure &_pressure) :
+  pressure(_pressure),
+  has_snapshot(false),
+  queue_head(0),
+  queue_tail(0),
+  dropped_cnt(0),
+  pending_profile(nullptr),
+  trigger(nullptr),
+  on_trigger(nullptr),
+  alarms(nullptr),
+  last_timestamp_uS(0),
+  time_ms(0),
+  time_frac_uS(0)
+{}
+
+void PressureAcquisition::begin()
+{
+  // timer0 is set up by the arduino core (prescaler 64, overflow
+  // every 1.024ms), compare in the middle between two overflows
+  OCR0A   = 128;
+  TIFR0   = 2; // clear OCF0A
+  TIMSK0 |= 2; // OCIE0A
+}
+
+void PressureAcquisition::isr()
+{
+  // no nesting of this ISR, but let all the others in
+  TIMSK0 &= ~2;
+  interrupts();
+
+  const SoftBMP280::Profile *profile = pending_profile;
+  bool switched = false;
+  if (profile) {
+    pending_profile = nullptr;
+    switched = pressure.apply_profile(*profile);
+  }
+  if ((!switched) && (pressure.poll_sensor_data())) {
+    publish();
+  }
+
+  noInterrupts();
+  TIMSK0 |= 2;
+}
+
+void PressureAcquisition::publish()
+{
+  PressureSnapshot s;
+  s.gauge_pressure   = pressure.get_gauge_pressure();
+  s.ambient_pressure = pressure.has_ambient() ? pressure.get_ambient_pressure() : 0;
+  s.temperature      = pressure.get_patient_sensor().get_latest_temp();
+  s.timestamp_uS     = pressure.get_latest_timestamp();
+  s.sequence         = snapshot.sequence() + 1;
+
+  if (has_snapshot) {
+    const uint32_t dt = s.timestamp_uS - last_timestamp_uS + time_frac_uS;
+    const uint32_t ms = dt / 1000;
+    time_ms      += (uint16_t)ms;
+    time_frac_uS  = dt - ms * 1000;
+  } else {
+    time_ms = (uint16_t)(s.timestamp_uS / 1000);
+  }
+  last_timestamp_uS = s.timestamp_uS;
+
+  snapshot.write(s);
+  has_snapshot = true;
+
+  const int16_t p = s.get_gauge_16();
+
+  if (alarms)
+    alarms->check_pressure(p);
+  if ((trigger) && (trigger->add(time_ms,p)) && (on_trigger))
+    on_trigger();
+
+  const uint8_t next = (queue_head + 1) & (queue_size - 1);
+  if (next == queue_tail) {
+    if (dropped_cnt < 255)
+      ++dropped_cnt;
+    return;
+  }
+  queue[next].time_ms  = time_ms;
+  queue[next].pressure = p;
+  queue_head = next;
+}
+
+bool PressureAcquisition::get_snapshot(PressureSnapshot &s) const
+{
+  if (!has_snapshot) {
+    memset(&s,0,sizeof(s));
+    return false;
+  }
+  snapshot.read(s);
+  return true;
+}
+
+bool PressureAcquisition::pop_sample(PressureSample &s)
+{
+  const uint8_t tail = queue_tail;
+  if (tail == queue_head)
+    return false;
+  const uint8_t next = (tail + 1) & (queue_size - 1);
+  s = queue[next];
+  queue_tail = next;
+  return true;
+}
+
+void PressureAcquisition::request_profile(const SoftBMP280::Profile &profile)
+{
+  noInterrupts();
+  pending_profile = &profile;
+  interrupts();
+}
@@ -0,0 +1,107 @@
+#ifndef PRESSURE_ACQUISITION_H
+#define PRESSURE_ACQUISITION_H
+
+#include <stdint.h>
+#include "diff_pressure.h"
+#include "pressure_log.h"
+#include "seq_lock.h"
+#include "trigger_detector.h"
+#include "alarm_engine.h"
+
+/*
+  Background acquisition of the gauge pressure
+
+  isr() is meant to be called from the timer0 compare match A interrupt,
+  which fires once per timer0 overflow (~1ms) in between the millis()
+  interrupts. It polls the sensors at their native rate, independent of
+  the main loop. As reading and triggering the sensors takes up to 2.5ms,
+  the interrupt disables itself and runs with interrupts enabled, so the
+  encoders and end stops are not delayed.
+
+  Results are published twice: the latest sample as a sequence locked
+  snapshot for anyone who just needs the current pressure (the control
+  and telemetry tasks, the alarms, the calibrations), and every 
+  sample through a small queue for consumers like the PressureLog. 
+  Profile switches are queued to the ISR, as it owns the sensor bus.
+
+  An optional TriggerDetector sees every sample right in the ISR, its
+  callback runs there, too, with interrupts enabled. The same goes for
+  the pressure check of an optional AlarmEngine, which runs first.
+*/
+
+struct PressureSnapshot {
+  int32_t  gauge_pressure;   // Pa
+  uint32_t ambient_pressure; // Pa, absolute, 0 without ambient sensor
+  int32_t  temperature;      // patient side, in 0.01 degC
+  uint32_t timestamp_uS;     // start of the conversion
+  uint8_t  sequence;         // increments with every sample
+
+  // saturated to 16 bit, like the samples of the PressureLog
+  int16_t get_gauge_16() const {
+    if (gauge_pressure >  32767) return  32767;
+    if (gauge_pressure < -32767) return -32767;
+    return (int16_t)gauge_pressure;
+  }
+};
+
+class PressureAcquisition {
+
+  static const uint8_t queue_size = 8;
+
+  DiffPressure &pressure;
+
+  SeqLock<PressureSnapshot> snapshot;
+  volatile bool has_snapshot;
+
+  // single producer (isr) / single consumer queue of samples
+  PressureSample queue[queue_size];
+  volatile uint8_t queue_head;
+  volatile uint8_t queue_tail;
+  volatile uint8_t dropped_cnt;
+
+  const SoftBMP280::Profile *volatile pending_profile;
+
+  TriggerDetector *trigger;
+  void (*on_trigger)();
+
+  AlarmEngine *alarms;
+
+  // ms time base of the samples, advanced by the differences of the 
+  // timestamps, as micros() wraps at 2^32, which is no multiple of 2^16 ms
+  uint32_t last_timestamp_uS;
+  uint16_t time_ms;
+  uint16_t time_frac_uS;
+
+public:
+
+  PressureAcquisition(DiffPressure &_pressure);
+
+  // sets up and enables the timer0 compare match A interrupt, 
+  // the acquisition needs to be started already
+  void begin();
+
+  void isr();
+
+  // never disables interrupts, returns false (and all zero) if there was no sample yet
+  bool get_snapshot(PressureSnapshot &s) const;
+
+  // returns false if the queue is empty
+  bool pop_sample(PressureSample &s);
+  // samples lost as the queue was full
+  uint8_t get_dropped_samples() const { return dropped_cnt; }
+
+  // the profile is applied with the next interrupt, it has to stay valid until then
+  void request_profile(const SoftBMP280::Profile &profile);
+
+  // set before begin(), callback may be nullptr
+  void set_trigger(TriggerDetector *detector, void (*callback)()) { trigger = detector; on_trigger = callback; }
+  // set before begin()
+  void set_alarms(AlarmEngine *engine) { alarms = engine; }
+
+private:
+
+  void publish();
+
+};
+
+#endif
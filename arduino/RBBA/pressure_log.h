@@ -0,0 +1,206 @@
+#ifndef PRESSURE_LOG_H
+#define PRESSURE_LOG_H
+
+#include <stdint.h>
+#include <string.h>
+
+/*
+  Ring buffer of timestamped gauge pressure samples with streaming operators
+
+  Every operator is updated in O(1) per added sample, so consumers (menu,
+  alarms, ...) just read the results instead of rescanning the samples:
+
+  - moving average over the last AvgWindow samples
+  - derivative in Pa/s over the last DerivSpan samples
+  - per breath minimum (PEEP), maximum (PIP) and plateau pressure
+
+  A new breath is detected when the averaged pressure rises more than
+  breath_rise above the minimum of the current breath, after it went
+  past its peak and came back down close to that minimum. At that point
+  the results of the breath are published. The plateau is the mean of the
+  last stretch after the peak where the derivative stays flat while the
+  pressure is above the middle between minimum and maximum, or 0 if
+  there was no such stretch.
+
+  The breath phase follows the same detection: inspiration from the start
+  of a breath, plateau while the flat stretch after the peak lasts and 
+  expiration once the pressure went past the peak.
+*/
+
+enum class BreathPhase : uint8_t {
+  inspiration,
+  plateau,
+  expiration
+};
+
+struct PressureSample {
+  uint16_t time_ms;
+  int16_t  pressure; // gauge pressure in Pa
+};
+
+template<uint8_t Size, uint8_t AvgWindow, uint8_t DerivSpan>
+class PressureLog {
+
+  static_assert((Size & (Size - 1)) == 0, "Size needs to be a power of two");
+  static_assert((AvgWindow <= Size) && (DerivSpan < Size), "windows need to fit into the buffer");
+
+  static const int16_t breath_rise    = 200; // Pa, ~2 cmH2O
+  static const int16_t plateau_slope  = 300; // Pa/s
+
+  PressureSample samples[Size];
+  uint8_t head;
+  uint8_t count;
+
+  int32_t avg_sum;
+  int16_t average;
+  int16_t derivative;
+
+  // current breath
+  int16_t cur_min;
+  int16_t cur_max;
+  int32_t flat_sum;
+  uint8_t flat_cnt;
+  int16_t cur_plateau;
+  bool    past_peak;
+  bool    armed;
+  BreathPhase phase;
+
+  // last completed breath
+  int16_t pip;
+  int16_t peep;
+  int16_t plateau;
+  uint16_t breath_start_ms;
+  uint16_t breath_duration_ms;
+  uint8_t  breath_cnt;
+
+public:
+
+  PressureLog() :
+    head(0),
+    count(0),
+    avg_sum(0),
+    average(0),
+    derivative(0),
+    pip(0),
+    peep(0),
+    plateau(0),
+    breath_start_ms(0),
+    breath_duration_ms(0),
+    breath_cnt(0)
+  {
+    memset(samples,0,sizeof(samples));
+    start_breath(0);
+  }
+
+  void add(const uint16_t time_ms, const int16_t pressure) {
+    // moving average
+    if (count >= AvgWindow)
+      avg_sum -= at(AvgWindow - 1).pressure;
+    avg_sum += pressure;
+
+    head = (head + 1) & (Size - 1);
+    samples[head].time_ms  = time_ms;
+    samples[head].pressure = pressure;
+    if (count < Size)
+      ++count;
+
+    const uint8_t n = count < AvgWindow ? count : AvgWindow;
+    average = (int16_t)(avg_sum / (int16_t)n);
+    if (count == 1)
+      start_breath(time_ms);
+
+    // derivative
+    if (count > DerivSpan) {
+      const PressureSample &old = at(DerivSpan);
+      const uint16_t dt = time_ms - old.time_ms;
+      if (dt > 0)
+        derivative = (int16_t)(((int32_t)pressure - (int32_t)old.pressure) * (int32_t)1000 / (int32_t)dt);
+    }
+
+    // per breath min / max / plateau, the peak is taken from 
+    // the raw samples, the minimum from the averaged ones
+    if (average < cur_min) {
+      cur_min = average;
+    }
+    if ((past_peak) && (average - cur_min < (breath_rise >> 1))) {
+      armed = true;
+    }
+    if ((armed) && (average - cur_min > breath_rise)) {
+      finish_breath(time_ms);
+    }
+    if (pressure > cur_max) {
+      // a flat stretch only counts after the peak
+      cur_max  = pressure;
+      flat_sum = 0;
+      flat_cnt = 0;
+    } else if (cur_max - average > breath_rise) {
+      past_peak = true;
+    }
+    const int16_t half = cur_min + ((cur_max - cur_min) >> 1);
+    if ((derivative < plateau_slope) && (derivative > -plateau_slope) && (average > half)) {
+      if (flat_cnt < 255) {
+        flat_sum += average;
+        ++flat_cnt;
+        cur_plateau = (int16_t)(flat_sum / flat_cnt);
+      }
+    } else {
+      flat_sum = 0;
+      flat_cnt = 0;
+    }
+
+    if (past_peak)
+      phase = BreathPhase::expiration;
+    else if (flat_cnt >= DerivSpan)
+      phase = BreathPhase::plateau;
+    else if (phase == BreathPhase::plateau)
+      phase = BreathPhase::inspiration;
+  }
+
+  // i = 0 is the latest sample
+  const PressureSample& at(const uint8_t i) const { return samples[(head - i) & (Size - 1)]; }
+  uint8_t size() const { return count; }
+
+  int16_t get_latest() const { return samples[head].pressure; }
+  int16_t get_average() const { return average; }
+  int16_t get_derivative() const { return derivative; }
+  BreathPhase get_phase() const { return phase; }
+
+  int16_t get_pip() const { return pip; }
+  int16_t get_peep() const { return peep; }
+  int16_t get_plateau() const { return plateau; }
+  uint16_t get_breath_duration() const { return breath_duration_ms; }
+  // increments with every completed breath
+  uint8_t get_breath_count() const { return breath_cnt; }
+
+  // pointers for the LCDMenuIntElements
+  int16_t* average_ptr() { return &average; }
+  int16_t* pip_ptr() { return &pip; }
+  int16_t* peep_ptr() { return &peep; }
+  int16_t* plateau_ptr() { return &plateau; }
+
+private:
+
+  void start_breath(const uint16_t time_ms) {
+    cur_min     = average;
+    cur_max     = average;
+    flat_sum    = 0;
+    flat_cnt    = 0;
+    cur_plateau = 0;
+    past_peak   = false;
+    armed       = false;
+    phase       = BreathPhase::inspiration;
+    breath_start_ms = time_ms;
+  }
+
+  void finish_breath(const uint16_t time_ms) {
+    pip     = cur_max;
+    peep    = cur_min;
+    plateau = cur_plateau;
+    breath_duration_ms = time_ms - breath_start_ms;
+    ++breath_cnt;
+    start_breath(time_ms);
+  }
+
+};
+
+#endif
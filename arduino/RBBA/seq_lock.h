@@ -0,0 +1,51 @@
+#ifndef SEQ_LOCK_H
+#define SEQ_LOCK_H
+
+#include <stdint.h>
+
+/*
+  Double-buffered sequence lock for data published from an ISR
+
+  The writer (a single ISR) fills the buffer that is not the current one
+  and increments the sequence number afterwards. A reader copies the 
+  current buffer and checks the sequence number again. As long as it 
+  advanced by less than two, the writer never touched the copied buffer,
+  otherwise the copy is retried. Readers therefore never disable 
+  interrupts and the writer never waits. Readers in a nested ISR work 
+  as well, as the writer only ever modifies the other buffer.
+*/
+
+template<typename T>
+class SeqLock {
+
+  T buffer[2];
+  volatile uint8_t seq;
+
+public:
+
+  SeqLock() : seq(0) {}
+
+  // only call from a single writer
+  void write(const T &value) {
+    const uint8_t s = seq + 1;
+    buffer[s & 1] = value;
+    asm volatile("" ::: "memory");
+    seq = s;
+  }
+
+  void read(T &value) const {
+    uint8_t s;
+    do {
+      s = seq;
+      asm volatile("" ::: "memory");
+      value = buffer[s & 1];
+      asm volatile("" ::: "memory");
+    } while ((uint8_t)(seq - s) >= 2);
+  }
+
+  // increments with every write
+  uint8_t sequence() const { return seq; }
+
+};
+
+#endif
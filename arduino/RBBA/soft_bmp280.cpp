@@ -1,26 +1,77 @@
 #include <Arduino.h>
 #include "soft_bmp280.h"
 
-SoftBMP280::SoftBMP280(
-  const uint8_t  address,
-  const uint8_t  scl_pin, 
-  const uint8_t  sda_pin, 
-  const uint16_t speed_khz 
-) :
-  SoftI2C(scl_pin,sda_pin,speed_khz),
-  slave_addr(address),
+SoftBMP280::SoftBMP280(BMP280Transport &_transport) :
+  transport(_transport),
   calibration(),
   latest_temp(0),
   latest_pressure(0),
   adc_temp(0),
   adc_pressure(0),
-  fine_temp(0)
+  ctrl_meas(0),
+  config(0),
+  config_dirty(false),
+  conversion_time_uS(0),
+  conversion_start_uS(0),
+  latest_timestamp_uS(0),
+  settle_cnt(0),
+  latest_valid(true),
+  temp_interval(1),
+  temp_countdown(0),
+  temp_dirty(false),
+  fine_temp(0),
+  temp_terms_valid(false),
+  temp_terms_adc(0),
+  press_offset(0),
+  press_divisor(0),
+  press_reciprocal(0)
 {}
 
 bool SoftBMP280::load_calibration()
 {
-  uint8_t register_addr = 0x88;
-  return transceive_wr(slave_addr,&register_addr,1,calibration.data,calib_data_size);  
+  // wait for the sensor to copy its NVM data after power-up
+  for (uint8_t i = 0; (i < 10) && (is_updating() != Status::inactive); ++i)
+    delay(1);
+  // over SPI a missing sensor does not fail the transfer, so check the id
+  // (0x56..0x58 for the BMP280 and its samples, 0x60 for the BME280)
+  uint8_t chip_id = 0;
+  if (!transport.read_regs(0xD0,&chip_id,1,false)) {
+    return false;
+  }
+  if (((chip_id < 0x56) || (chip_id > 0x58)) && (chip_id != 0x60)) {
+    return false;
+  }
+  if (!transport.read_regs(0x88,calibration.data,calib_data_size,false)) {
+    return false;
+  }
+  return read_configuration();
+}
+
+bool SoftBMP280::read_configuration()
+{
+  uint8_t register_data[2];
+  if (!transport.read_regs(0xF4,register_data,2,false)) {
+    return false;
+  }
+  ctrl_meas    = register_data[0];
+  config       = register_data[1];
+  config_dirty = false;
+  return true;
+}
+
+// writes all staged changes in one transfer as register/value pairs.
+// Writes to config may be ignored in normal mode, hence the sensor is 
+// put to sleep first and ctrl_meas (incl. the mode) is written last.
+bool SoftBMP280::commit_configuration()
+{
+  if (!config_dirty)
+    return true;
+  uint8_t data[6] = {0xF4,(uint8_t)(ctrl_meas & ~3),0xF5,config,0xF4,ctrl_meas};
+  if (!transport.write_regs(data,6,false)) {
+    return false;
+  }
+  config_dirty = false;
+  return true;
 }
 
 void SoftBMP280::print_calibration()
@@ -61,75 +112,77 @@ int32_t SoftBMP280::compensate_temp(int32_t u_temp)
   */
 }
 
-// requires call to compensate_temp beforehand as it uses 
-// the fine_temp intermediate result set by compensate_temp
-uint32_t SoftBMP280::compensate_pressure(int32_t u_press)
+// computes all terms of the pressure compensation that only depend on
+// the temperature, including the divisor and its reciprocal
+void SoftBMP280::update_temp_terms(int32_t u_temp)
 {
+  latest_temp = compensate_temp(u_temp);
+  temp_dirty  = false;
+
   int32_t var1, var2;
-  uint32_t p;
   var1 = (((int32_t)fine_temp)>>1) - (int32_t)64000;
   var2 = (((var1>>2) * (var1>>2)) >> 11 ) * ((int32_t)calibration.coeff.p6);
   var2 = var2 + ((var1*((int32_t)calibration.coeff.p5))<<1);
   var2 = (var2>>2)+(((int32_t)calibration.coeff.p4)<<16);
   var1 = (((calibration.coeff.p3 * (((var1>>2) * (var1>>2)) >> 13 )) >> 3) + ((((int32_t)calibration.coeff.p2) * var1)>>1))>>18;
   var1 =((((32768+var1))*((int32_t)calibration.coeff.p1))>>15);
-  if (var1 == 0)
+
+  press_offset     = var2 >> 12;
+  press_divisor    = (uint32_t)var1;
+  press_reciprocal = var1 == 0 ? 0 : (uint32_t)0xFFFFFFFF / press_divisor;
+  temp_terms_adc   = u_temp;
+  temp_terms_valid = true;
+}
+
+// upper 32 bit of the 64 bit product a * b, built from 16x16 bit
+// multiplications which are cheap on the avr compared to a division
+static uint32_t mul_hi32(const uint32_t a, const uint32_t b)
+{
+  const uint16_t ah = a >> 16, al = a;
+  const uint16_t bh = b >> 16, bl = b;
+  const uint32_t hh = (uint32_t)ah * bh;
+  const uint32_t hl = (uint32_t)ah * bl;
+  const uint32_t lh = (uint32_t)al * bh;
+  const uint32_t ll = (uint32_t)al * bl;
+  const uint32_t mid = (hl & 0xFFFF) + (lh & 0xFFFF) + (ll >> 16);
+  return hh + (hl >> 16) + (lh >> 16) + (mid >> 16);
+}
+
+// requires call to update_temp_terms beforehand as it uses 
+// the cached temperature dependent terms. The division of the reference
+// implementation is replaced by a multiplication with the cached 
+// reciprocal plus a remainder correction, which yields the exact same result
+uint32_t SoftBMP280::compensate_pressure(int32_t u_press)
+{
+  if (press_divisor == 0)
   {
   return 0; // avoid exception caused by division by zero
   }
-  p = (((uint32_t)(((int32_t)1048576)-u_press)-(var2>>12)))*3125;
+  uint32_t p = (((uint32_t)(((int32_t)1048576)-u_press)-press_offset))*3125;
+  // the estimate is at most two below p / press_divisor
+  uint32_t q = mul_hi32(p,press_reciprocal);
+  uint32_t r = p - q * press_divisor;
+  while (r >= press_divisor) {
+    ++q;
+    r -= press_divisor;
+  }
   if (p < 0x80000000)
   {
-  p = (p << 1) / ((uint32_t)var1);
+  p = (q << 1) + ((r << 1) >= press_divisor ? 1 : 0);
   }
   else
   {
-  p = (p / (uint32_t)var1) * 2;
+  p = q * 2;
   }
+  int32_t var1, var2;
   var1 = (((int32_t)calibration.coeff.p9) * ((int32_t)(((p>>3) * (p>>3))>>13)))>>12;
   var2 = (((int32_t)(p>>2)) * ((int32_t)calibration.coeff.p8))>>13;
   p = (uint32_t)((int32_t)p + ((var1 + var2 + calibration.coeff.p7) >> 4));
   return p;
-
-  /*
-  int32_t v1   = (fine_temp >> 1) - (int32_t)64000;
-  int32_t v1d4 = v1 >> 2;
-  int32_t v2   = ((v1d4 * v1d4) >> 11) * (int32_t)calibration.coeff.p6;
-
-  v2 += (v1 * (int32_t)calibration.coeff.p5) << 1;
-  
-  v2 = (v2 >> 2) + (int32_t)calibration.coeff.p4 << 16;
-
-  v1 = ((((int32_t)calibration.coeff.p3 * ((v1d4 * v1d4) >> 13)) >> 3) + (((int32_t)calibration.coeff.p2 * v1) >> 1)) >> 18;
-
-  v1 = (((int32_t)32768 + v1) * (int32_t)calibration.coeff.p1) >> 15;
-
-  if (v1 == 0) return 0;
-
-  uint32_t p = ((uint32_t)((int32_t)1048576 - u_press) - (v2 >> 12)) * (int32_t)3125;
-
-  if (p < 0x80000000) {
-    p = (p << 1) / (uint32_t)v1;
-  } else {
-    p = (p / (uint32_t)v1) * 2;
-  }
-
-  uint32_t pd8 = p >> 3;
-
-  v1 = ((int32_t)calibration.coeff.p9 * (int32_t)((pd8 * pd8) >> 13)) >> 12;
-
-  v2 = ((int32_t)(p >> 2) * (int32_t)calibration.coeff.p8) >> 13;
-
-  return ((v1 + v2 + (int32_t)calibration.coeff.p7) >> 4) + (int32_t)p;
-  */
 }
 
 SoftBMP280::Oversampling SoftBMP280::get_temp_oversampling() {
-  uint8_t register_addr = 0xF4;
-  uint8_t register_data = 0;
-  if (!transceive_wr(slave_addr,&register_addr,1,&register_data,1)) {
-    return Oversampling::error;
-  }
+  uint8_t register_data = ctrl_meas;
 
   register_data >>= 5;
   switch (register_data) {
@@ -148,11 +201,7 @@ SoftBMP280::Oversampling SoftBMP280::get_temp_oversampling() {
 }
 
 SoftBMP280::Oversampling SoftBMP280::get_pressure_oversampling() {
-  uint8_t register_addr = 0xF4;
-  uint8_t register_data = 0;
-  if (!transceive_wr(slave_addr,&register_addr,1,&register_data,1)) {
-    return Oversampling::error;
-  }
+  uint8_t register_data = ctrl_meas;
 
   register_data = (register_data >> 2) & 7;
   switch (register_data) {
@@ -171,11 +220,7 @@ SoftBMP280::Oversampling SoftBMP280::get_pressure_oversampling() {
 }
 
 SoftBMP280::FilterCoeff SoftBMP280::get_filter_coeff() {
-  uint8_t register_addr = 0xF5;
-  uint8_t register_data = 0;
-  if (!transceive_wr(slave_addr,&register_addr,1,&register_data,1)) {
-    return FilterCoeff::error;
-  }
+  uint8_t register_data = config;
 
   register_data = (register_data >> 2) & 7;
   switch (register_data) {
@@ -194,11 +239,7 @@ SoftBMP280::FilterCoeff SoftBMP280::get_filter_coeff() {
 }
 
 SoftBMP280::Mode SoftBMP280::get_mode() {
-  uint8_t register_addr = 0xF4;
-  uint8_t register_data = 0;
-  if (!transceive_wr(slave_addr,&register_addr,1,&register_data,1)) {
-    return Mode::error;
-  }
+  uint8_t register_data = ctrl_meas;
 
   register_data = register_data & 3;
   switch (register_data) {
@@ -212,11 +253,7 @@ SoftBMP280::Mode SoftBMP280::get_mode() {
 }
 
 SoftBMP280::StandbyTime SoftBMP280::get_standby_time() {
-  uint8_t register_addr = 0xF5;
-  uint8_t register_data = 0;
-  if (!transceive_wr(slave_addr,&register_addr,1,&register_data,1)) {
-    return StandbyTime::error;
-  }
+  uint8_t register_data = config;
 
   register_data >>= 5 ;
   switch (register_data) {
@@ -235,29 +272,22 @@ SoftBMP280::StandbyTime SoftBMP280::get_standby_time() {
 }
 
 SoftBMP280::Status SoftBMP280::is_measuring() {
-  uint8_t register_addr = 0xF3;
   uint8_t register_data = 0;
-  if (!transceive_wr(slave_addr,&register_addr,1,&register_data,1)) {
+  if (!transport.read_regs(0xF3,&register_data,1,false)) {
     return Status::error;
   }
   return (register_data & 8) > 0 ? Status::active : Status::inactive;
 }
 
 SoftBMP280::Status SoftBMP280::is_updating() {
-  uint8_t register_addr = 0xF3;
   uint8_t register_data = 0;
-  if (!transceive_wr(slave_addr,&register_addr,1,&register_data,1)) {
+  if (!transport.read_regs(0xF3,&register_data,1,false)) {
     return Status::error;
   }
   return (register_data & 1) > 0 ? Status::active : Status::inactive;  
 }
 
 void SoftBMP280::set_temp_oversampling(Oversampling os) {
-  uint8_t data[2] = {0xF4,0};
-  if (!transceive_wr(slave_addr,data,1,data+1,1)) {
-    return;
-  }
-
   uint8_t os_flags = 0;
   switch (os) {
     case Oversampling::skipped : os_flags = 0; break;
@@ -268,17 +298,11 @@ void SoftBMP280::set_temp_oversampling(Oversampling os) {
     case Oversampling::x16     : os_flags = 5; break;
     case Oversampling::error   : os_flags = 0; break;
   }
-  data[1] = (data[1] & ~(7 << 5)) | (os_flags << 5);
-
-  transmit(slave_addr,data,2);
+  ctrl_meas = (ctrl_meas & ~(7 << 5)) | (os_flags << 5);
+  config_dirty = true;
 }
 
 void SoftBMP280::set_pressure_oversampling(Oversampling os) {
-  uint8_t data[2] = {0xF4,0};
-  if (!transceive_wr(slave_addr,data,1,data+1,1)) {
-    return;
-  }
-
   uint8_t os_flags = 0;
   switch (os) {
     case Oversampling::skipped : os_flags = 0; break;
@@ -289,17 +313,11 @@ void SoftBMP280::set_pressure_oversampling(Oversampling os) {
     case Oversampling::x16     : os_flags = 5; break;
     case Oversampling::error   : os_flags = 0; break;
   }
-  data[1] = (data[1] & ~(7 << 2)) | (os_flags << 2);
-
-  transmit(slave_addr,data,2);  
+  ctrl_meas = (ctrl_meas & ~(7 << 2)) | (os_flags << 2);
+  config_dirty = true;
 }
 
 void SoftBMP280::set_filter_coeff(FilterCoeff fc) {
-  uint8_t data[2] = {0xF5,0};
-  if (!transceive_wr(slave_addr,data,1,data+1,1)) {
-    return;
-  }
-
   uint8_t fc_flags = 0;
   switch (fc) {
     case FilterCoeff::off   : fc_flags = 0; break;
@@ -309,17 +327,11 @@ void SoftBMP280::set_filter_coeff(FilterCoeff fc) {
     case FilterCoeff::c16   : fc_flags = 4; break;
     case FilterCoeff::error : fc_flags = 0; break;
   }
-  data[1] = (data[1] & ~(7 << 2)) | (fc_flags << 2);
-
-  transmit(slave_addr,data,2);    
+  config = (config & ~(7 << 2)) | (fc_flags << 2);
+  config_dirty = true;
 }
 
 void SoftBMP280::set_mode(Mode m) {
-  uint8_t data[2] = {0xF4,0};
-  if (!transceive_wr(slave_addr,data,1,data+1,1)) {
-    return;
-  }
-
   uint8_t m_flags = 0;
   switch (m) {
     case Mode::sleep  : m_flags = 0; break;
@@ -327,17 +339,11 @@ void SoftBMP280::set_mode(Mode m) {
     case Mode::forced : m_flags = 1; break;
     case Mode::error  : m_flags = 0; break;
   }
-  data[1] = (data[1] & ~3) | m_flags;
-
-  transmit(slave_addr,data,2);  
+  ctrl_meas = (ctrl_meas & ~3) | m_flags;
+  config_dirty = true;
 }
 
 void SoftBMP280::set_standby_time(StandbyTime t) {
-  uint8_t data[2] = {0xF5,0};
-  if (!transceive_wr(slave_addr,data,1,data+1,1)) {
-    return;
-  }
-
   uint8_t t_flags = 0;
   switch (t) {
     case StandbyTime::ms0_5  : t_flags = 0; break;
@@ -350,24 +356,140 @@ void SoftBMP280::set_standby_time(StandbyTime t) {
     case StandbyTime::ms4000 : t_flags = 7; break;
     case StandbyTime::error  : t_flags = 0; break;
   }
-  data[1] = (data[1] & ~(7 << 5)) | (t_flags << 5);
-
-  transmit(slave_addr,data,2);  
+  config = (config & ~(7 << 5)) | (t_flags << 5);
+  config_dirty = true;
 }
 
-void SoftBMP280::read_sensor_data()
+bool SoftBMP280::read_sensor_data(const bool hold_bus)
 {
-  uint8_t register_addr = 0xF7;
+  // pressure and temperature registers are consecutive (0xF7..0xFC),
+  // so most of the time we stop after the three pressure bytes
+  const bool with_temp = (temp_countdown == 0);
   uint8_t register_data[6];
-  if (!transceive_wr(slave_addr,&register_addr,1,register_data,6)) {
-    return;
+  if (!transport.read_regs(0xF7,register_data,with_temp ? 6 : 3,hold_bus)) {
+    return false;
+  }
+
+  // SPI has no acknowledge, a missing sensor shows up as implausible data
+  const int32_t adc_p = ((int32_t)register_data[0] << 12) | ((int32_t)register_data[1] << 4) | (int32_t)(register_data[2] >> 4);
+  const int32_t adc_t = with_temp ? ((int32_t)register_data[3] << 12) | ((int32_t)register_data[4] << 4) | (int32_t)(register_data[5] >> 4) : adc_temp;
+  if ((!is_adc_plausible(adc_p)) || ((with_temp) && (!is_adc_plausible(adc_t)))) {
+    return false;
   }
 
-  adc_pressure = ((int32_t)register_data[0] << 12) | ((int32_t)register_data[1] << 4) | (int32_t)(register_data[2] >> 4);
-  adc_temp     = ((int32_t)register_data[3] << 12) | ((int32_t)register_data[4] << 4) | (int32_t)(register_data[5] >> 4);
+  adc_pressure = adc_p;
+  if (with_temp) {
+    adc_temp       = adc_t;
+    temp_dirty     = true;
+    temp_countdown = temp_interval;
+  }
+  --temp_countdown;
   
-  latest_temp = compensate_temp(adc_temp);  
+  if ((!temp_terms_valid) || (abs(adc_temp - temp_terms_adc) > temp_refresh_threshold)) {
+    update_temp_terms(adc_temp);
+  }
   latest_pressure = compensate_pressure(adc_pressure);  
+  latest_timestamp_uS = conversion_start_uS;
+  latest_valid = (settle_cnt == 0);
+  if (settle_cnt)
+    --settle_cnt;
+  return true;
+}
+
+// a floating or shorted data line reads all ones or all zeros, and
+// 0x80000 is the reset value of the result registers (no conversion)
+bool SoftBMP280::is_adc_plausible(const int32_t adc)
+{
+  return (adc != 0) && (adc != 0xFFFFF) && (adc != 0x80000);
+}
+
+uint8_t SoftBMP280::os_factor(Oversampling os)
+{
+  switch (os) {
+    case Oversampling::x1  : return 1;
+    case Oversampling::x2  : return 2;
+    case Oversampling::x4  : return 4;
+    case Oversampling::x8  : return 8;
+    case Oversampling::x16 : return 16;
+    default                : return 0;
+  }
+  return 0;
+}
+
+// max. measurement time according to the datasheet (section 3.8.1):
+// 1.25ms + 2.3ms * osrs_t + (2.3ms * osrs_p + 0.575ms), e.g., 13.3ms for t x1, p x4
+void SoftBMP280::update_conversion_time()
+{
+  const uint8_t t_os = os_factor(get_temp_oversampling());
+  const uint8_t p_os = os_factor(get_pressure_oversampling());
+  conversion_time_uS = 1250 + (uint32_t)2300 * t_os;
+  if (p_os)
+    conversion_time_uS += (uint32_t)2300 * p_os + 575;
+}
+
+uint8_t SoftBMP280::filter_settle_samples(FilterCoeff fc)
+{
+  switch (fc) {
+    case FilterCoeff::c2  : return 2;
+    case FilterCoeff::c4  : return 5;
+    case FilterCoeff::c8  : return 11;
+    case FilterCoeff::c16 : return 22;
+    default               : return 1;
+  }
+  return 1;
+}
+
+bool SoftBMP280::apply_profile(const Profile &profile, const bool hold_bus)
+{
+  set_pressure_oversampling(profile.pressure_os);
+  set_filter_coeff(profile.filter);
+  if (!commit_configuration()) {
+    return false;
+  }
+  update_conversion_time();
+  // the conversion in flight (if any) is never read, as trigger_conversion
+  // restarts it with the new settings, only the filter needs to settle, 
+  // i.e., the samples before the one reaching 75% of the step are discarded
+  settle_cnt = filter_settle_samples(profile.filter) - 1;
+  return trigger_conversion(hold_bus);
+}
+
+bool SoftBMP280::trigger_conversion(const bool hold_bus)
+{
+  uint8_t data[2] = {0xF4,(uint8_t)((ctrl_meas & ~3) | 1)};
+  conversion_start_uS = micros();
+  return transport.write_regs(data,2,hold_bus);
+}
+
+bool SoftBMP280::conversion_complete() const
+{
+  return micros() - conversion_start_uS >= conversion_time_uS;
+}
+
+void SoftBMP280::start_acquisition()
+{
+  set_mode(Mode::sleep);
+  commit_configuration();
+  update_conversion_time();
+  trigger_conversion();
+}
+
+bool SoftBMP280::poll_sensor_data()
+{
+  if (!conversion_complete())
+    return false;
+  const bool result = read_sensor_data();
+  trigger_conversion();
+  return result && latest_valid;
+}
+
+int32_t SoftBMP280::get_latest_temp()
+{
+  if (temp_dirty) {
+    latest_temp = compensate_temp(adc_temp);
+    temp_dirty  = false;
+  }
+  return latest_temp;
 }
 
 void SoftBMP280::print_mode(Mode mode){
@@ -2,11 +2,11 @@
 #define SOFT_BMP280_H
 
 #include <stdint.h>
-#include "soft_i2c.h"
+#include "bmp280_transport.h"
 
-class SoftBMP280 : protected SoftI2C {
+class SoftBMP280 {
 
-  const uint8_t slave_addr;
+  BMP280Transport &transport; // I2C or SPI, see bmp280_transport.h
 
   static const uint8_t calib_data_size = 24;
 
@@ -34,6 +34,26 @@ class SoftBMP280 : protected SoftI2C {
   int32_t adc_temp;
   int32_t adc_pressure;
 
+  // shadow copies of the ctrl_meas (0xF4) and config (0xF5) registers, 
+  // the set_* functions only stage changes until commit_configuration
+  uint8_t ctrl_meas;
+  uint8_t config;
+  bool    config_dirty;
+
+  // sample aligned acquisition in forced mode
+  uint32_t conversion_time_uS;  // max. duration of a conversion, see update_conversion_time
+  uint32_t conversion_start_uS; // micros() when the current conversion was triggered
+  uint32_t latest_timestamp_uS; // micros() when the conversion of the latest sample was triggered
+
+  // number of samples to discard after a profile switch
+  uint8_t settle_cnt;
+  bool    latest_valid;
+
+  // temperature is only read every temp_interval reads or on request
+  uint8_t temp_interval;
+  uint8_t temp_countdown;
+  bool    temp_dirty; // latest_temp needs to be recomputed from adc_temp
+
 public:
 
   enum class Mode : uint8_t {
@@ -80,14 +100,39 @@ public:
     error
   };
 
-  SoftBMP280(
-    const uint8_t  address,
-    const uint8_t  scl_pin, 
-    const uint8_t  sda_pin, 
-    const uint16_t speed_khz // max 250khz
-  );
+  /*
+    Profiles allow to trade latency against noise at runtime, e.g., 
+    depending on the breath phase. Temperature oversampling stays as is.
+    Conversion times are the max. values of the datasheet model (see 
+    update_conversion_time) with temperature x1. Noise is relative to 
+    pressure x1 w/o filter, assuming white noise, i.e., 1/sqrt(n) for 
+    oversampling and 1/sqrt(2c-1) for the IIR filter with coefficient c.
+    Filter latency is the number of samples to reach 75% of a step 
+    according to the datasheet (off: 1, c2: 2, c4: 5, c8: 11, c16: 22).
+
+      pressure os | filter | conversion | noise | step latency (75%)
+      x1          | off    |  6.4 ms    | 1.00  |  1 sample  ~  6 ms
+      x2          | off    |  8.7 ms    | 0.71  |  1 sample  ~  9 ms
+      x4          | off    | 13.3 ms    | 0.50  |  1 sample  ~ 13 ms
+      x4          | c4     | 13.3 ms    | 0.19  |  5 samples ~ 67 ms
+      x8          | c4     | 22.5 ms    | 0.13  |  5 samples ~ 113 ms
+      x16         | c16    | 40.9 ms    | 0.05  | 22 samples ~ 900 ms
+
+    After a profile switch the conversion in flight is restarted with the
+    new settings, and the samples before the filter reaches 75% are
+    discarded (none without filter, 4 with c4).
+  */
+  struct Profile {
+    Oversampling pressure_os;
+    FilterCoeff  filter;
+  };
+
+  SoftBMP280(BMP280Transport &_transport);
+
+  bool load_calibration(); // returns true if successful, includes chip id check and read_configuration
+  bool read_configuration(); // updates the shadow registers from the sensor
 
-  bool load_calibration(); // returns true if successful
+  // the getters answer from the shadow registers, i.e., they include staged changes
 
   Oversampling get_temp_oversampling();
   Oversampling get_pressure_oversampling();
@@ -102,10 +147,41 @@ public:
   void set_filter_coeff(FilterCoeff fc);
   void set_mode(Mode m);
   void set_standby_time(StandbyTime t);
-  
-  void read_sensor_data();
 
-  int32_t get_latest_temp() const { return latest_temp; }
+  bool commit_configuration(); // returns true if successful
+  
+  // returns true if successful, hold_bus chains the next transfer on the bus (see BMP280Transport)
+  bool read_sensor_data(const bool hold_bus = false);
+
+  // Instead of reading whatever the sensor has in normal mode at a fixed
+  // slot, the conversions can be triggered by us (forced mode). Each
+  // conversion is read as soon as it is complete according to the max.
+  // conversion time of the current oversampling settings, and the next
+  // one is triggered right away. This way every sample is fresh, no
+  // sample is read twice, and its timestamp is known exactly.
+  void start_acquisition();
+  bool poll_sensor_data(); // returns true if a new (valid) sample was read
+  bool conversion_complete() const;
+  // false if the latest sample was discarded due to a profile switch
+  bool is_latest_valid() const { return latest_valid; }
+
+  // true if the (shadow) configuration already matches the profile
+  bool uses_profile(const Profile &profile) {
+    return (get_pressure_oversampling() == profile.pressure_os) && (get_filter_coeff() == profile.filter);
+  }
+  // switches the profile and restarts the acquisition, returns true if successful
+  bool apply_profile(const Profile &profile, const bool hold_bus = false);
+  bool trigger_conversion(const bool hold_bus = false);
+  uint32_t get_latest_timestamp() const { return latest_timestamp_uS; }
+  uint32_t get_conversion_time() const { return conversion_time_uS; }
+
+  // 1 reads temperature and pressure every time, n > 1 reads only the 
+  // pressure and includes the temperature on every n-th read
+  void set_temp_interval(const uint8_t n) { temp_interval = n > 0 ? n : 1; temp_countdown = 0; }
+  // includes the temperature on the next read
+  void request_temp() { temp_countdown = 0; }
+
+  int32_t get_latest_temp();
   uint32_t get_latest_pressure() const { return latest_pressure; }
 
   int32_t get_latest_adc_temp() const { return adc_temp; }
@@ -123,9 +199,26 @@ public:
 
 private:
 
+  // temperature changes slowly, so everything that only depends on it is 
+  // cached and recomputed if adc_temp moved by more than this (~0.02 C)
+  static const int32_t temp_refresh_threshold = 64;
+
   int32_t  fine_temp; // intermediate result shared between compensate_temp and compensate_pressure
   int32_t  compensate_temp(int32_t u_temp);
-  uint32_t compensate_pressure(int32_t u_press); // requires call to compensate_temp beforehand
+  uint32_t compensate_pressure(int32_t u_press); // requires call to update_temp_terms beforehand
+
+  bool     temp_terms_valid;
+  int32_t  temp_terms_adc;      // adc_temp the cached terms belong to
+  int32_t  press_offset;        // var2 >> 12 of the pressure compensation
+  uint32_t press_divisor;       // var1 of the pressure compensation
+  uint32_t press_reciprocal;    // (2^32-1) / press_divisor
+  void     update_temp_terms(int32_t u_temp);
+
+  static uint8_t os_factor(Oversampling os);
+  static uint8_t filter_settle_samples(FilterCoeff fc);
+  // false for readings of a missing sensor or of no conversion
+  static bool is_adc_plausible(const int32_t adc);
+  void update_conversion_time();
 
 };
 
@@ -202,6 +202,13 @@ void SoftHD44780::print( const char *data )
     put_data( *data++ );
 }
 
+void SoftHD44780::print_P( const char *data )
+{
+  char c;
+  while( ( c = pgm_read_byte( data++ ) ) != '\0' )
+    put_data( c );
+}
+
 void SoftHD44780::set_LED_background(const bool on)
 {
   led_bg = on ? 8 : 0;
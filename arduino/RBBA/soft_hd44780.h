@@ -40,6 +40,9 @@ public:
 
   void print(const char *data);
 
+  // string in flash (PROGMEM)
+  void print_P(const char *data);
+
   void set_LED_background(const bool on);
 
 private:
@@ -48,6 +48,18 @@ void SoftI2C::send_stop()
     delayMicroseconds(quarter_delay_uS);
 }
 
+// after the last ack of a write the slave still pulls sda low,
+// release it and leave scl high for a repeated start condition
+void SoftI2C::prepare_restart()
+{
+    scl_low();
+    delayMicroseconds(quarter_delay_uS);
+    sda_high();
+    delayMicroseconds(quarter_delay_uS);
+    scl_high();
+    delayMicroseconds(quarter_delay_uS);
+}
+
 void SoftI2C::send_start()
 {
   delayMicroseconds(quarter_delay_uS);
@@ -104,7 +116,8 @@ uint8_t SoftI2C::read_byte(uint8_t ack)
 bool SoftI2C::transmit( // returns true if succesful
   uint8_t slave_address,
   uint8_t *data,
-  uint8_t data_size)
+  uint8_t data_size,
+  bool    hold_bus)
 {
   // issue start condition
   send_start();
@@ -124,7 +137,11 @@ bool SoftI2C::transmit( // returns true if succesful
     }
     ++data;
   }
-  send_stop();
+  if (hold_bus) {
+    prepare_restart();
+  } else {
+    send_stop();
+  }
   return true;
 }
  
@@ -157,7 +174,8 @@ bool SoftI2C::transceive_wr( // returns true if succesful
   uint8_t *write_data,
   uint8_t write_data_size,
   uint8_t *read_data,
-  uint8_t read_data_size)
+  uint8_t read_data_size,
+  bool    hold_bus)
 {
   // issue start condition
   send_start();
@@ -192,7 +210,8 @@ bool SoftI2C::transceive_wr( // returns true if succesful
     *read_data = read_byte(read_data == last);
     ++read_data;
   }
-  send_stop();
+  if (!hold_bus)
+    send_stop();
   return true;  
 }
 
@@ -17,10 +17,15 @@ public:
     const uint16_t speed_khz // max 250khz
   );
 
+  // If hold_bus is set, no stop condition is sent after a successful
+  // transfer and the start condition of the next transfer becomes a
+  // repeated start. This way transfers to several slaves can be chained.
+
   bool transmit( // returns true if succesful
     uint8_t slave_address,
     uint8_t *data,
-    uint8_t data_size
+    uint8_t data_size,
+    bool    hold_bus = false
   );
    
   bool receive( // returns true if succesful
@@ -34,7 +39,8 @@ public:
     uint8_t *write_data,
     uint8_t write_data_size,
     uint8_t *read_data,
-    uint8_t read_data_size
+    uint8_t read_data_size,
+    bool    hold_bus = false
   );
 
   bool transceive_rw( // returns true if succesful
@@ -57,6 +63,7 @@ private:
 
   void send_stop();
   void send_start();
+  void prepare_restart();
 
   uint8_t send_byte(uint8_t value);
   uint8_t read_byte(uint8_t ack);
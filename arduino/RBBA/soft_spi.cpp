@@ -0,0 +1,40 @@
+#include <Arduino.h>
+#include "soft_spi.h"
+
+SoftSPI::SoftSPI(
+  const uint8_t sck_pin,
+  const uint8_t mosi_pin,
+  const uint8_t miso_pin
+) :
+  sck_reg(portOutputRegister(digitalPinToPort(sck_pin))),
+  mosi_reg(portOutputRegister(digitalPinToPort(mosi_pin))),
+  miso_reg(portInputRegister(digitalPinToPort(miso_pin))),
+  sck_mask(digitalPinToBitMask(sck_pin)),
+  mosi_mask(digitalPinToBitMask(mosi_pin)),
+  miso_mask(digitalPinToBitMask(miso_pin))
+{
+  pinMode(sck_pin,OUTPUT);
+  digitalWrite(sck_pin,LOW);
+  pinMode(mosi_pin,OUTPUT);
+  digitalWrite(mosi_pin,LOW);
+  pinMode(miso_pin,INPUT_PULLUP);
+}
+
+// mode 0: data is set up while sck is low and sampled on the rising edge
+uint8_t SoftSPI::transfer(uint8_t value)
+{
+  uint8_t result = 0;
+  for (uint8_t i = 0; i < 8; ++i) {
+    if (value & 0x80)
+      *mosi_reg |= mosi_mask;
+    else
+      *mosi_reg &= ~mosi_mask;
+    value <<= 1;
+    *sck_reg |= sck_mask;
+    result <<= 1;
+    if (*miso_reg & miso_mask)
+      result |= 1;
+    *sck_reg &= ~sck_mask;
+  }
+  return result;
+}
@@ -0,0 +1,38 @@
+#ifndef SOFT_SPI_H
+#define SOFT_SPI_H
+
+#include <stdint.h>
+
+/*
+  Bit-banged SPI master (mode 0, msb first)
+
+  The hardware SPI pins are taken by the LCD, so this runs on any pins.
+  The port registers are accessed directly, which gives a clock of about
+  0.5MHz on a 16MHz avr, instead of the ~50kHz one would get with 
+  digitalWrite. The pins should not share a port with pins that are 
+  written from an ISR, as the port accesses are not atomic.
+  Chip select is up to the caller, so several slaves can share the bus.
+*/
+
+class SoftSPI {
+
+  volatile uint8_t *const sck_reg;
+  volatile uint8_t *const mosi_reg;
+  volatile uint8_t *const miso_reg;
+  const uint8_t sck_mask;
+  const uint8_t mosi_mask;
+  const uint8_t miso_mask;
+
+public:
+
+  SoftSPI(
+    const uint8_t sck_pin,
+    const uint8_t mosi_pin,
+    const uint8_t miso_pin
+  );
+
+  uint8_t transfer(uint8_t value); // returns the byte received while sending value
+
+};
+
+#endif
@@ -2,66 +2,143 @@
 #define STATE_MACHINE_H
 
 #include <stdint.h>
+#include "timer_service.h"
+
+/*
+  The id of a state is part of its type, so the state machine can check at
+  compile time that the states are declared in enum order, i.e., the enum 
+  value of a state is its index in the table. Executing a step is then a
+  single indexed call. The end id (and any other id past the last state)
+  lies outside of the table and ends the run.
+
+  Besides its transition function, a state can have an entry and an exit
+  action and a timeout, after which it transitions to a given state. The
+  entry action runs at the beginning of the first step in the state, the
+  exit action when the state is left for another one (returning the own 
+  id stays in the state). The timeout is checked against the TimerService
+  before the transition function is called. A state without transition 
+  function just waits for its timeout and costs a single comparison per
+  step. Example:
+
+    make_state<S,S::wait>().with_entry([](){ ... }).with_timeout(200,S::next)
+*/
 
 template<typename E>
 using StateTransitionFunc = E (*) ();
 
-template<typename E>
+using StateActionFunc = void (*) ();
+
+template<typename E, E Id>
 struct STF {
-  E state_transition_id;
   StateTransitionFunc<E> state_transition_func;
+  StateActionFunc        entry_func;
+  StateActionFunc        exit_func;
+  uint16_t               timeout_ms; // 0 = no timeout
+  E                      timeout_id;
+
+  STF with_entry(StateActionFunc func) const { STF s = *this; s.entry_func = func; return s; }
+  STF with_exit(StateActionFunc func) const { STF s = *this; s.exit_func = func; return s; }
+  STF with_timeout(uint16_t ms, E id) const { STF s = *this; s.timeout_ms = ms; s.timeout_id = id; return s; }
 };
 
-template<typename E, typename F>
-auto make_state(E state_id, F func) -> STF<E> 
+template<typename E, E Id, typename F>
+auto make_state(F func) -> STF<E,Id> 
+{
+  return STF<E,Id>{func,nullptr,nullptr,0,Id};
+}
+
+// a state that only waits for its timeout
+template<typename E, E Id>
+auto make_state() -> STF<E,Id> 
 {
-  return STF<E>({state_id,func});
+  return STF<E,Id>{nullptr,nullptr,nullptr,0,Id};
 }
 
+template<uint8_t Idx, typename... StateTransitions>
+struct StatesInEnumOrder {
+  static const bool value = true;
+};
+
+template<uint8_t Idx, typename E, E Id, typename... StateTransitions>
+struct StatesInEnumOrder<Idx, STF<E,Id>, StateTransitions...> {
+  static const bool value = (static_cast<uint8_t>(Id) == Idx) && 
+                            StatesInEnumOrder<Idx + 1, StateTransitions...>::value;
+};
+
+template<typename E>
+struct StateDesc {
+  StateTransitionFunc<E> state_transition_func;
+  StateActionFunc        entry_func;
+  StateActionFunc        exit_func;
+  uint16_t               timeout_ms;
+  E                      timeout_id;
+};
+
 template<typename E, typename... StateTransitions>
 class StateMachine {
 
   static const uint8_t nr_of_states = sizeof...(StateTransitions);
 
-  STF<E> state_transitions[nr_of_states];
+  static_assert(StatesInEnumOrder<0, StateTransitions...>::value, "states need to be declared in enum order");
+
+  StateDesc<E> states[nr_of_states];
 
   E start_id;
   E end_id;
 
-  int8_t next_transition;
+  uint8_t  cur_state;
+  bool     entering;
+  uint16_t entry_ms;
 
 public:
 
   StateMachine(E _start_id, E _end_id, StateTransitions... st) :
-    state_transitions{static_cast<STF<E>>(st)...},
+    states{{st.state_transition_func,st.entry_func,st.exit_func,st.timeout_ms,st.timeout_id}...},
     start_id(_start_id),
     end_id(_end_id),
-    next_transition(0)
-  {
-    next_transition = get_idx(start_id);
-  }
+    cur_state(static_cast<uint8_t>(_start_id)),
+    entering(true),
+    entry_ms(0)
+  {}
 
   bool execute_step() {
-    E next_id = state_transitions[next_transition].state_transition_func();
-    if (next_id == end_id) {
-      next_transition = get_idx(start_id);
+    const StateDesc<E> &s = states[cur_state];
+    if (entering) {
+      entering = false;
+      entry_ms = TimerService::now();
+      if (s.entry_func)
+        s.entry_func();
+    }
+
+    E next_id;
+    if ((s.timeout_ms) && (TimerService::elapsed_since(entry_ms) >= s.timeout_ms))
+      next_id = s.timeout_id;
+    else if (s.state_transition_func)
+      next_id = s.state_transition_func();
+    else
+      return false;
+
+    const uint8_t idx = static_cast<uint8_t>(next_id);
+    if (idx == cur_state)
+      return false;
+
+    if (s.exit_func)
+      s.exit_func();
+    entering = true;
+    if ((next_id == end_id) || (idx >= nr_of_states)) {
+      cur_state = static_cast<uint8_t>(start_id);
       return true;
     }
-    next_transition = get_idx(next_id);
+    cur_state = idx;
     return false;
   }
 
-private:
+  // index (i.e., enum value) of the current state
+  uint8_t get_state() const { return cur_state; }
+
+  // ms since the current state was entered
+  uint16_t time_in_state() const { return TimerService::elapsed_since(entry_ms); }
 
-  int8_t get_idx(E state_id) {
-    for (uint8_t i = 0; i < nr_of_states; ++i){
-      if (state_transitions[i].state_transition_id == state_id) {
-        return (int8_t)i;
-      }
-    }
-    return -1; 
-  }
-  
 };
 
 template<typename E, typename... StateTransitions>
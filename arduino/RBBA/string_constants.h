@@ -1,6 +1,8 @@
 #ifndef STRING_CONSTANTS_H
 #define STRING_CONSTANTS_H
 
+#include <avr/pgmspace.h>
+
 static const char* str_RBBA        = "RBBA";
 static const char* str_v10         = "v1.0";
 static const char* str_nPatient    = "new patient";
@@ -26,6 +28,48 @@ static const char* str_of_nine       = "/9";
 static const char* str_go            = "go";
 static const char* str_enter_vol     = "Enter vol:";
 static const char* str_ml            = "ml";
+static const char* str_l             = "l";
 static const char* str_ok            = "ok";
 
+static const char* str_Pa          = "Pa";
+
+// the strings below live in flash (PROGMEM), for LCDMenuFlashTextElement
+
+static const char str_Monitor[]     PROGMEM = "monitor";
+static const char str_diag[]        PROGMEM = "diag";
+static const char str_auto[]        PROGMEM = "auto";
+static const char str_start[]       PROGMEM = "start";
+static const char str_profile[]     PROGMEM = "profile";
+static const char str_bag_autocal[] PROGMEM = "Bag volume auto:";
+static const char str_bag_profile[] PROGMEM = "Bag profile:";
+static const char str_trigger[]     PROGMEM = "trigger";
+
+static const char str_pressure_Pa[] PROGMEM = "pressure Pa:";
+static const char str_PIP[]         PROGMEM = "PIP";
+static const char str_PEEP[]        PROGMEM = "PEEP";
+static const char str_plateau[]     PROGMEM = "plat.";
+static const char str_trg[]         PROGMEM = "trg";
+
+static const char str_test[]         PROGMEM = "test";
+static const char str_test_strokes[] PROGMEM = "Test strokes:";
+static const char str_stop[]         PROGMEM = "stop";
+
+static const char str_ov[]          PROGMEM = "ov";
+static const char str_dump[]        PROGMEM = "dump";
+
+static const char str_alarm[]       PROGMEM = "ALARM:";
+static const char str_ack[]         PROGMEM = "ack";
+
+static const char str_over_pressure[] PROGMEM = "over pressure";
+static const char str_sensor_fail[]   PROGMEM = "sensor fail";
+static const char str_end_stop[]      PROGMEM = "end stop";
+static const char str_disconnected[]  PROGMEM = "disconnected";
+// in the order of the Alarm enum
+static const char* const str_alarm_names[] PROGMEM = {
+  str_over_pressure,
+  str_sensor_fail,
+  str_end_stop,
+  str_disconnected
+};
+
 #endif
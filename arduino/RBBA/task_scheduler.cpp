@@ -0,0 +1,149 @@
+#include <Arduino.h>
+#include <avr/sleep.h>
+#include "task_scheduler.h"
+
+TaskScheduler::TaskScheduler(
+  Task           *_tasks, 
+  const uint8_t  _nr_of_tasks, 
+  const uint16_t _max_background_slice
+) :
+  tasks(_tasks),
+  nr_of_tasks(_nr_of_tasks),
+  max_background_slice(_max_background_slice),
+  next_background(0)
+{}
+
+void TaskScheduler::start()
+{
+  // normal mode, prescaler of 64 -> 250 ticks per millisecond
+  TCCR1A = 0;
+  TCCR1B = 3;
+  TCCR1C = 0;  
+  const uint16_t now = TCNT1;
+  for (uint8_t i = 0; i < nr_of_tasks; ++i)
+    tasks[i].next_release = now + tasks[i].offset;
+  reset_stats();
+}
+
+void TaskScheduler::reset_stats()
+{
+  for (uint8_t i = 0; i < nr_of_tasks; ++i) {
+    tasks[i].exec.reset();
+    if (tasks[i].late)
+      tasks[i].late->reset();
+    tasks[i].overruns = 0;
+  }
+}
+
+uint16_t TaskScheduler::get_overruns() const
+{
+  uint16_t result = 0;
+  for (uint8_t i = 0; i < nr_of_tasks; ++i)
+    result += tasks[i].overruns;
+  return result;
+}
+
+uint16_t TaskScheduler::time_to_next_release() const
+{
+  return time_to_next_release(TCNT1);
+}
+
+uint16_t TaskScheduler::time_to_next_release(const uint16_t now) const
+{
+  uint16_t result = 0xFFFF;
+  for (uint8_t i = 0; i < nr_of_tasks; ++i) {
+    if (tasks[i].period == 0)
+      continue;
+    const int16_t dt = (int16_t)(tasks[i].next_release - now);
+    if (dt <= 0)
+      return 0;
+    if ((uint16_t)dt < result)
+      result = dt;
+  }
+  return result;
+}
+
+bool TaskScheduler::run()
+{
+  const uint16_t now = TCNT1;
+  Task *due = nullptr;
+  for (uint8_t i = 0; i < nr_of_tasks; ++i) {
+    Task &t = tasks[i];
+    if (t.period == 0)
+      continue;
+    if ((int16_t)(now - t.next_release) < 0)
+      continue;
+    if ((!due) || (t.priority < due->priority))
+      due = &t;
+  }
+  if (due) {
+    execute(*due);
+    return true;
+  }
+
+  const uint16_t spare = time_to_next_release();
+  for (uint8_t n = 0; n < nr_of_tasks; ++n) {
+    const uint8_t i = next_background;
+    next_background = (next_background + 1) % nr_of_tasks;
+    Task &t = tasks[i];
+    if ((t.period != 0) || (!t.pending))
+      continue;
+    const uint16_t wcet   = t.get_wcet();
+    const uint16_t needed = wcet < max_background_slice ? wcet : max_background_slice;
+    if (spare < needed)
+      continue;
+    execute(t);
+    return true;
+  }
+  return false;
+}
+
+void TaskScheduler::idle()
+{
+  // the compare match must not be set up for a time that already passed,
+  // hence the check and the sleep happen with interrupts disabled (the 
+  // instruction after sei is executed before any pending interrupt)
+  noInterrupts();
+  const uint16_t now = TCNT1;
+  const uint16_t dt  = time_to_next_release(now);
+  if (dt < min_sleep_ticks) {
+    interrupts();
+    return;
+  }
+  OCR1A   = now + dt;
+  TIFR1   = 2; // clear OCF1A
+  TIMSK1 |= 2; // OCIE1A
+  set_sleep_mode(SLEEP_MODE_IDLE);
+  sleep_enable();
+  interrupts();
+  sleep_cpu();
+  sleep_disable();
+}
+
+void TaskScheduler::execute(Task &t)
+{
+  const uint16_t start = TCNT1;
+  t.func();
+  const uint16_t end = TCNT1;
+
+  t.exec.add(end - start);
+
+  if (t.period == 0) {
+    t.pending = false;
+    return;
+  }
+
+  if (t.late)
+    t.late->add(start - t.next_release);
+  for (uint8_t i = 0; i < nr_of_tasks; ++i)
+    if (tasks[i].period == 0)
+      tasks[i].pending = true;
+
+  t.next_release += t.period;
+  if ((int16_t)(end - t.next_release) > 0) {
+    if (t.overruns < 0xFFFF)
+      ++t.overruns;
+    while ((int16_t)(end - t.next_release) > 0)
+      t.next_release += t.period;
+  }
+}
@@ -0,0 +1,99 @@
+#ifndef TASK_SCHEDULER_H
+#define TASK_SCHEDULER_H
+
+#include <stdint.h>
+#include "timing_stats.h"
+
+/*
+  Cooperative, time-triggered task scheduler on the free running timer1
+
+  Periodic tasks are released every period ticks (4uS each with the
+  prescaler of 64), shifted by their offset. If several tasks are due,
+  the one with the highest priority (lowest value) runs first. Tasks 
+  are never interrupted by other tasks, so they need to be short.
+  Background tasks (period 0) get the time left over: each of them runs
+  once after every release of a periodic task (round robin), if no 
+  periodic task is due and its worst case execution time fits in before
+  the next release. When there is nothing left to do, idle() sleeps 
+  until the next release. As a background task could 
+  take longer than any gap in the schedule, its wcet is capped at 
+  max_background_slice for that check, i.e., it may delay the periodic
+  tasks once in a while instead of never running.
+
+  The execution time of every run is measured (exec, its max is the 
+  wcet), as well as how late a periodic task started after its release
+  (late, i.e., the jitter of its period, kept outside of the task as
+  background tasks don't need it). A periodic task overruns if 
+  it finishes after its next release, in which case the missed releases
+  are skipped (the phase is kept).
+
+  Timer1 wraps every 65536 ticks (~262ms), so periods need to stay
+  below half of that.
+*/
+
+struct Task {
+  void (*func)();
+  uint16_t period;   // ticks, 0 for background tasks
+  uint16_t offset;   // ticks after the start of the scheduler
+  uint8_t  priority; // 0 is the highest, only used for periodic tasks
+  const char *name;  // in flash (PROGMEM)
+  TimingStats *late; // start delay, periodic tasks only, nullptr for background tasks
+
+  // measured by the scheduler
+  uint16_t    next_release;
+  bool        pending; // background task that did not run since the last release
+  TimingStats exec;
+  uint16_t    overruns;
+
+  uint16_t get_wcet() const { return exec.get_max(); }
+};
+
+class TaskScheduler {
+
+  Task *const   tasks;
+  const uint8_t nr_of_tasks;
+  const uint16_t max_background_slice;
+
+  uint8_t next_background;
+
+public:
+
+  static const uint16_t ticks_per_ms = 250;
+
+  TaskScheduler(
+    Task           *_tasks, 
+    const uint8_t  _nr_of_tasks, 
+    const uint16_t _max_background_slice
+  );
+
+  // sets up timer1 as free running counter and the first releases
+  void start();
+
+  // runs at most one task, returns false if there was nothing to do
+  bool run();
+
+  // Puts the cpu into idle sleep until the next release, where the timer1
+  // compare match A interrupt wakes it up (needs an ISR that does nothing).
+  // Other interrupts wake it up earlier, it is fine to call idle() again.
+  void idle();
+
+  // ticks until the next periodic task is due, 0 if one is due already
+  uint16_t time_to_next_release() const;
+
+  uint8_t get_task_count() const { return nr_of_tasks; }
+  Task& get_task(const uint8_t i) { return tasks[i]; }
+
+  // total number of overruns of all tasks
+  uint16_t get_overruns() const;
+  void reset_stats();
+
+private:
+
+  static const uint16_t min_sleep_ticks = 4;
+
+  uint16_t time_to_next_release(const uint16_t now) const;
+  void execute(Task &t);
+
+};
+
+#endif
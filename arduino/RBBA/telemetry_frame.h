@@ -0,0 +1,280 @@
+#ifndef TELEMETRY_FRAME_H
+#define TELEMETRY_FRAME_H
+
+#include <stdint.h>
+
+/*
+  Binary telemetry frames, shared by the device and host tools 
+
+  Plain C++ without any arduino dependencies. Frame layout:
+
+    0xA5 | kind << 6 | payload size | seq | payload | crc8
+
+  The crc8 (polynomial 0x07) covers everything after the sync byte. A 
+  key frame carries all values as they are (little endian):
+
+    time_ms u32 | pressure i16 | enc i16 | set_pos i16 | pwm i16 | 
+    states u8 x nr_of_states | dropped u8
+
+  A delta frame carries a flags byte (bit i set if value i changed, 
+  values in the order above, then the states), the time delta and the 
+  changed values as zigzag varints of the difference to the previous 
+  frame (states as raw bytes). A delta frame can only be decoded if the
+  previous one was received, so the encoder sends a key frame every 
+  key_interval frames and after a frame was dropped (invalidate()).
+  At 50Hz the typical delta frame of 8-10 bytes needs ~500 byte/s, a
+  key frame 22 bytes, so 115200 baud leave plenty of room.
+*/
+
+struct TelemetrySample {
+  static const uint8_t nr_of_states = 4; // up to 4, see the flags byte of delta frames
+
+  uint32_t time_ms;
+  int16_t  pressure;     // Pa
+  int16_t  enc_value;
+  int16_t  set_position;
+  int16_t  pwm;
+  uint8_t  state[nr_of_states]; // breath phase, motor and bag calibration, latched alarms
+  uint8_t  dropped;      // frames the device dropped so far, updated by key frames
+};
+
+struct TelemetryFrame {
+  static const uint8_t sync        = 0xA5;
+  static const uint8_t kind_key    = 1;
+  static const uint8_t kind_delta  = 2;
+  static const uint8_t header_size = 3; // sync, kind/size, seq
+  static const uint8_t key_payload = 4 + 2 * 4 + TelemetrySample::nr_of_states + 1;
+  static const uint8_t max_payload = 1 + 3 + 3 * 4 + TelemetrySample::nr_of_states; // delta frame, worst case
+  static const uint8_t max_size    = header_size + max_payload + 1;
+
+  static uint8_t crc8(const uint8_t *data, uint8_t size) {
+    uint8_t crc = 0;
+    for (uint8_t i = 0; i < size; ++i) {
+      crc ^= data[i];
+      for (uint8_t b = 0; b < 8; ++b)
+        crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x07) : (uint8_t)(crc << 1);
+    }
+    return crc;
+  }
+
+  static uint16_t zigzag(const int16_t v) { return (uint16_t)((uint16_t)v << 1) ^ (uint16_t)(v >> 15); }
+  static int16_t unzigzag(const uint16_t v) { return (int16_t)((v >> 1) ^ (uint16_t)(-(int16_t)(v & 1))); }
+};
+
+class TelemetryEncoder {
+
+  static const uint8_t key_interval = 50;
+
+  TelemetrySample prev;
+  uint8_t seq;
+  uint8_t since_key;
+  bool    need_key;
+
+public:
+
+  TelemetryEncoder() : prev(), seq(0), since_key(0), need_key(true) {}
+
+  // the next frame will be a key frame, e.g., after a frame was dropped
+  void invalidate() { need_key = true; }
+
+  // writes the frame into buffer (at least TelemetryFrame::max_size bytes) and returns its size
+  uint8_t encode(const TelemetrySample &s, uint8_t *buffer) {
+    uint8_t *p = buffer + TelemetryFrame::header_size;
+    uint8_t kind;
+    if ((need_key) || (since_key >= key_interval)) {
+      kind = TelemetryFrame::kind_key;
+      put32(p,s.time_ms);
+      put16(p,s.pressure);
+      put16(p,s.enc_value);
+      put16(p,s.set_position);
+      put16(p,s.pwm);
+      for (uint8_t i = 0; i < TelemetrySample::nr_of_states; ++i)
+        *p++ = s.state[i];
+      *p++ = s.dropped;
+      need_key  = false;
+      since_key = 0;
+    } else {
+      kind = TelemetryFrame::kind_delta;
+      uint8_t *flags = p++;
+      *flags = 0;
+      put_varint(p,(uint16_t)(s.time_ms - prev.time_ms));
+      put_delta(p,flags,0,s.pressure,prev.pressure);
+      put_delta(p,flags,1,s.enc_value,prev.enc_value);
+      put_delta(p,flags,2,s.set_position,prev.set_position);
+      put_delta(p,flags,3,s.pwm,prev.pwm);
+      for (uint8_t i = 0; i < TelemetrySample::nr_of_states; ++i) {
+        if (s.state[i] != prev.state[i]) {
+          *flags |= 1 << (4 + i);
+          *p++ = s.state[i];
+        }
+      }
+      ++since_key;
+    }
+    prev = s;
+    const uint8_t payload = p - buffer - TelemetryFrame::header_size;
+    buffer[0] = TelemetryFrame::sync;
+    buffer[1] = (kind << 6) | payload;
+    buffer[2] = seq++;
+    *p = TelemetryFrame::crc8(buffer + 1,p - buffer - 1);
+    return p - buffer + 1;
+  }
+
+private:
+
+  static void put16(uint8_t *&p, const int16_t v) { *p++ = (uint8_t)v; *p++ = (uint8_t)((uint16_t)v >> 8); }
+  static void put32(uint8_t *&p, const uint32_t v) { for (uint8_t i = 0; i < 4; ++i) *p++ = (uint8_t)(v >> (8 * i)); }
+
+  // up to 3 bytes, 7 bits each, lsb first
+  static void put_varint(uint8_t *&p, uint16_t v) {
+    while (v >= 0x80) {
+      *p++ = (uint8_t)v | 0x80;
+      v >>= 7;
+    }
+    *p++ = (uint8_t)v;
+  }
+
+  static void put_delta(uint8_t *&p, uint8_t *flags, const uint8_t bit, const int16_t v, const int16_t prev_v) {
+    if (v == prev_v)
+      return;
+    *flags |= 1 << bit;
+    put_varint(p,TelemetryFrame::zigzag((int16_t)((uint16_t)v - (uint16_t)prev_v)));
+  }
+
+};
+
+/*
+  Decodes frames straight from a receive buffer without copying them.
+  parse() looks for the next complete frame in data, skipping garbage
+  (e.g., text output) on the way to the next sync byte.
+*/
+class TelemetryDecoder {
+
+  TelemetrySample prev;
+  uint8_t prev_seq;
+  bool    synced; // prev is valid for deltas
+
+  uint32_t crc_errors;
+  uint32_t lost_frames;
+
+public:
+
+  enum class Result : uint8_t {
+    sample,     // out holds a new sample
+    need_more,  // the remaining bytes do not hold a complete frame
+    skipped     // a frame or garbage was consumed without result
+  };
+
+  TelemetryDecoder() : prev(), prev_seq(0), synced(false), crc_errors(0), lost_frames(0) {}
+
+  uint32_t get_crc_errors() const { return crc_errors; }
+  uint32_t get_lost_frames() const { return lost_frames; }
+
+  // consumed is set to the number of bytes that can be discarded
+  Result parse(const uint8_t *data, const uint32_t size, TelemetrySample &out, uint32_t &consumed) {
+    uint32_t start = 0;
+    while ((start < size) && (data[start] != TelemetryFrame::sync))
+      ++start;
+    consumed = start;
+    if (start > 0)
+      return Result::skipped;
+    if (size < TelemetryFrame::header_size)
+      return Result::need_more;
+
+    const uint8_t kind    = data[1] >> 6;
+    const uint8_t payload = data[1] & 63;
+    const uint32_t frame_size = TelemetryFrame::header_size + payload + 1;
+    if ((payload > TelemetryFrame::max_payload) || 
+        ((kind != TelemetryFrame::kind_key) && (kind != TelemetryFrame::kind_delta))) {
+      consumed = 1; // not a frame after all
+      return Result::skipped;
+    }
+    if (size < frame_size)
+      return Result::need_more;
+    if (TelemetryFrame::crc8(data + 1,frame_size - 2) != data[frame_size - 1]) {
+      ++crc_errors;
+      consumed = 1;
+      return Result::skipped;
+    }
+    consumed = frame_size;
+
+    const uint8_t seq = data[2];
+    const uint8_t *p   = data + TelemetryFrame::header_size;
+    const uint8_t *end = p + payload;
+    if ((synced) && (seq != (uint8_t)(prev_seq + 1)))
+      lost_frames += (uint8_t)(seq - prev_seq - 1);
+    
+    TelemetrySample s;
+    if (kind == TelemetryFrame::kind_key) {
+      if (payload != TelemetryFrame::key_payload)
+        return Result::skipped;
+      s.time_ms      = get32(p);
+      s.pressure     = get16(p);
+      s.enc_value    = get16(p);
+      s.set_position = get16(p);
+      s.pwm          = get16(p);
+      for (uint8_t i = 0; i < TelemetrySample::nr_of_states; ++i)
+        s.state[i] = *p++;
+      s.dropped = *p++;
+    } else {
+      if ((!synced) || (seq != (uint8_t)(prev_seq + 1))) {
+        synced   = false;
+        prev_seq = seq;
+        return Result::skipped;
+      }
+      s = prev;
+      const uint8_t flags = *p++;
+      uint16_t v;
+      if (!get_varint(p,end,v)) return fail(seq);
+      s.time_ms += v;
+      int16_t *fields[4] = {&s.pressure,&s.enc_value,&s.set_position,&s.pwm};
+      for (uint8_t i = 0; i < 4; ++i) {
+        if (!(flags & (1 << i)))
+          continue;
+        if (!get_varint(p,end,v)) return fail(seq);
+        *fields[i] = (int16_t)((uint16_t)*fields[i] + (uint16_t)TelemetryFrame::unzigzag(v));
+      }
+      for (uint8_t i = 0; i < TelemetrySample::nr_of_states; ++i) {
+        if (!(flags & (1 << (4 + i))))
+          continue;
+        if (p >= end) return fail(seq);
+        s.state[i] = *p++;
+      }
+    }
+    prev     = s;
+    prev_seq = seq;
+    synced   = true;
+    out      = s;
+    return Result::sample;
+  }
+
+private:
+
+  Result fail(const uint8_t seq) {
+    synced   = false;
+    prev_seq = seq;
+    return Result::skipped;
+  }
+
+  static int16_t get16(const uint8_t *&p) { const uint16_t v = p[0] | ((uint16_t)p[1] << 8); p += 2; return (int16_t)v; }
+  static uint32_t get32(const uint8_t *&p) { 
+    const uint32_t v = p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24); 
+    p += 4; 
+    return v; 
+  }
+
+  static bool get_varint(const uint8_t *&p, const uint8_t *end, uint16_t &v) {
+    v = 0;
+    for (uint8_t shift = 0; shift < 21; shift += 7) {
+      if (p >= end)
+        return false;
+      const uint8_t b = *p++;
+      v |= (uint16_t)(b & 0x7F) << shift;
+      if (!(b & 0x80))
+        return true;
+    }
+    return false;
+  }
+
+};
+
+#endif
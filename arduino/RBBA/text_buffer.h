@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <string.h>
+#include <avr/pgmspace.h>
 
 class TextBuffer {
 
@@ -12,6 +13,9 @@ public:
 
   virtual void put(const char *text) = 0;
 
+  // text in flash (PROGMEM)
+  virtual void put_P(const char *text) = 0;
+
 };
 
 template<uint8_t BufferSize>
@@ -31,6 +35,10 @@ public:
     strncpy(buffer,text,BufferSize);
   }
 
+  void put_P(const char *text) {
+    strncpy_P(buffer,text,BufferSize);
+  }
+
 };
 
 #endif
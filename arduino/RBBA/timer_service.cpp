@@ -0,0 +1,9 @@
+#include <Arduino.h>
+#include "timer_service.h"
+
+uint16_t TimerService::now_ms = 0;
+
+void TimerService::tick()
+{
+  now_ms = (uint16_t)millis();
+}
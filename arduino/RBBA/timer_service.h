@@ -0,0 +1,27 @@
+#ifndef TIMER_SERVICE_H
+#define TIMER_SERVICE_H
+
+#include <stdint.h>
+
+/*
+  Shared time base for everything that waits for a deadline
+
+  tick() reads millis() once per control loop iteration, all users 
+  (e.g., timed state transitions) compare against that cached value.
+  Times are 16 bit, so durations up to ~65s can be measured as long as
+  the differences are computed in uint16_t.
+*/
+
+class TimerService {
+
+  static uint16_t now_ms;
+
+public:
+
+  static void tick();
+  static uint16_t now() { return now_ms; }
+  static uint16_t elapsed_since(const uint16_t time_ms) { return now_ms - time_ms; }
+
+};
+
+#endif
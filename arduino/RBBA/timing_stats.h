@@ -0,0 +1,83 @@
+#ifndef TIMING_STATS_H
+#define TIMING_STATS_H
+
+#include <stdint.h>
+
+/*
+  Running statistics of durations in timer ticks
+
+  Keeps min, max, an exponential moving average (1/16 weight per 
+  sample) and a histogram with bins growing by a factor of four:
+  [0,16) [16,64) [64,256) [256,1024) [1024,4096) [4096,..) ticks, 
+  i.e., 64uS, 256uS, 1ms, 4ms and 16ms at 4uS per tick. The counters
+  saturate, so the histogram stays meaningful for long runs.
+*/
+
+class TimingStats {
+
+public:
+
+  static const uint8_t nr_of_bins = 6;
+
+private:
+
+  uint16_t min_ticks;
+  uint16_t max_ticks;
+  uint16_t avg_ticks;
+  uint32_t avg_x16;
+  uint16_t count;
+  uint16_t hist[nr_of_bins];
+
+public:
+
+  TimingStats() {
+    reset();
+  }
+
+  void reset() {
+    min_ticks = 0;
+    max_ticks = 0;
+    avg_ticks = 0;
+    avg_x16   = 0;
+    count     = 0;
+    for (uint8_t i = 0; i < nr_of_bins; ++i)
+      hist[i] = 0;
+  }
+
+  void add(const uint16_t ticks) {
+    if (count == 0) {
+      min_ticks = ticks;
+      max_ticks = ticks;
+      avg_x16   = (uint32_t)ticks << 4;
+    } else {
+      if (ticks < min_ticks) min_ticks = ticks;
+      if (ticks > max_ticks) max_ticks = ticks;
+      avg_x16 = avg_x16 - (avg_x16 >> 4) + ticks;
+    }
+    avg_ticks = (uint16_t)(avg_x16 >> 4);
+    if (count < 0xFFFF)
+      ++count;
+
+    uint8_t bin = 0;
+    uint16_t limit = 16;
+    while ((bin < nr_of_bins - 1) && (ticks >= limit)) {
+      ++bin;
+      limit <<= 2;
+    }
+    if (hist[bin] < 0xFFFF)
+      ++hist[bin];
+  }
+
+  uint16_t get_min() const { return min_ticks; }
+  uint16_t get_max() const { return max_ticks; }
+  uint16_t get_avg() const { return avg_ticks; }
+  uint16_t get_count() const { return count; }
+  uint16_t get_bin(const uint8_t i) const { return hist[i]; }
+
+  // pointers for the LCDMenuIntElements
+  uint16_t* avg_ptr() { return &avg_ticks; }
+  uint16_t* max_ptr() { return &max_ticks; }
+
+};
+
+#endif
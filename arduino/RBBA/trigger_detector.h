@@ -0,0 +1,108 @@
+#ifndef TRIGGER_DETECTOR_H
+#define TRIGGER_DETECTOR_H
+
+#include <stdint.h>
+
+/*
+  Detection of spontaneous inspiratory efforts of the patient
+
+  Meant to see every pressure sample right where it is acquired, so a
+  trigger is reported within one sample period. The detector tracks the
+  baseline (PEEP) as a moving average and triggers as soon as a sample
+  falls more than the sensitivity below it. While a sample is below the
+  baseline by more than half of the sensitivity, the baseline is frozen,
+  so a slowly developing effort can not drag it along.
+
+  A sample more than the sensitivity above the baseline belongs to a
+  (machine) breath. It (re)starts the refractory period, as does a
+  trigger, and moves the baseline only very slowly, so PEEP changes are
+  followed eventually. No trigger is reported during the refractory
+  period. In it, the baseline follows fast, so it settles on PEEP while
+  the expiration decays, before the detector is armed again.
+
+  Plain C++, so the host tools can replay recorded traces through it.
+*/
+
+class TriggerDetector {
+
+  // the baseline has 8 fractional bits, the rates are per sample
+  static const uint8_t frac_shift      = 8;
+  static const int8_t  rate_breath     = 1;  // 1/256
+  static const int8_t  rate_armed      = 8;  // 1/32
+  static const int8_t  rate_refractory = 32; // 1/8
+
+  int32_t  baseline_fp;
+  uint8_t  sensitivity;  // Pa below the baseline
+  uint16_t refractory_ms;
+  uint16_t refractory_start_ms;
+  bool     in_refractory;
+  bool     initialized;
+  uint8_t  trigger_cnt;
+
+public:
+
+  TriggerDetector(const uint8_t sensitivity_Pa, const uint16_t _refractory_ms) :
+    baseline_fp(0),
+    sensitivity(sensitivity_Pa),
+    refractory_ms(_refractory_ms),
+    refractory_start_ms(0),
+    in_refractory(false),
+    initialized(false),
+    trigger_cnt(0)
+  {}
+
+  // returns true if the sample triggers a breath
+  bool add(const uint16_t time_ms, const int16_t pressure) {
+    if (!initialized) {
+      baseline_fp = (int32_t)pressure * (int32_t)(1 << frac_shift);
+      initialized = true;
+    }
+    const int32_t diff = (int32_t)pressure - (int32_t)get_baseline();
+
+    if (diff > (int32_t)sensitivity) {
+      restart_refractory(time_ms);
+      baseline_fp += diff * rate_breath;
+      return false;
+    }
+
+    if ((in_refractory) && ((uint16_t)(time_ms - refractory_start_ms) >= refractory_ms))
+      in_refractory = false;
+
+    if (in_refractory) {
+      baseline_fp += diff * rate_refractory;
+      return false;
+    }
+
+    if (-diff > (int32_t)sensitivity) {
+      restart_refractory(time_ms);
+      ++trigger_cnt;
+      return true;
+    }
+
+    if (-diff <= (int32_t)(sensitivity >> 1))
+      baseline_fp += diff * rate_armed;
+    return false;
+  }
+
+  void restart_refractory(const uint16_t time_ms) {
+    refractory_start_ms = time_ms;
+    in_refractory       = true;
+  }
+
+  int16_t get_baseline() const { return (int16_t)(baseline_fp >> frac_shift); }
+  bool is_refractory() const { return in_refractory; }
+
+  void set_sensitivity(const uint8_t sensitivity_Pa) { sensitivity = sensitivity_Pa; }
+  void set_refractory(const uint16_t ms) { refractory_ms = ms; }
+
+  // increments with every trigger
+  uint8_t get_trigger_count() const { return trigger_cnt; }
+
+  // pointers for the LCDMenuIntElements, single bytes, so they can be
+  // changed and shown while the detector runs in an interrupt
+  uint8_t* sensitivity_ptr() { return &sensitivity; }
+  uint8_t* trigger_count_ptr() { return &trigger_cnt; }
+
+};
+
+#endif
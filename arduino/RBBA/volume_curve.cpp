@@ -0,0 +1,166 @@
+#include "volume_curve.h"
+
+VolumeCurve::VolumeCurve() :
+  origin_position(0),
+  max_position(0),
+  max_volume(0),
+  position_scale(0),
+  volume_scale(0),
+  valid(false)
+{
+}
+
+namespace {
+
+// walks along the segments of the calibration curve, point 0 is the
+// origin (0 ml), the following ones are the volumes (made monotone) at
+// their positions, points not beyond the origin are skipped
+struct CurveWalker {
+  int32_t  first;
+  int32_t  span;
+  const uint16_t *volumes;
+  uint8_t  n;
+
+  uint8_t  k; // next point
+  int32_t  x0, x1;
+  uint16_t v0, v1;
+
+  CurveWalker(const int16_t origin, const int16_t first_position, const int16_t last_position, const uint16_t *_volumes, const uint8_t _n) :
+    first(first_position),
+    span(last_position - first_position),
+    volumes(_volumes),
+    n(_n),
+    k(0),
+    x0(origin),
+    x1(origin),
+    v0(0),
+    v1(0)
+  {
+    while ((k < n) && (position_of(k) <= origin))
+      ++k;
+    next();
+  }
+
+  int32_t position_of(const uint8_t i) const {
+    return first + span * i / (int32_t)(n - 1);
+  }
+
+  bool next() {
+    if (k >= n)
+      return false;
+    x0 = x1;
+    v0 = v1;
+    x1 = position_of(k);
+    v1 = volumes[k] > v0 ? volumes[k] : v0;
+    ++k;
+    return true;
+  }
+};
+
+}
+
+bool VolumeCurve::build(
+  const int16_t   origin,
+  const int16_t   first_position,
+  const int16_t   last_position,
+  const uint16_t *volumes,
+  const uint8_t   n
+)
+{
+  valid = false;
+  if ((n < 2) || (origin < 0) || (first_position < 0) || 
+      (last_position <= first_position) || (last_position <= origin))
+    return false;
+
+  origin_position = origin;
+  max_position    = last_position;
+  position_scale  = ((uint32_t)segments << scale_shift) / (uint32_t)max_position;
+
+  // volume over position, 0 up to the origin
+  CurveWalker fwd(origin,first_position,last_position,volumes,n);
+  for (uint8_t j = 0; j <= segments; ++j) {
+    const int32_t x = (int32_t)max_position * j / segments;
+    while ((x > fwd.x1) && (fwd.next()));
+    if (x <= fwd.x0)
+      volume[j] = fwd.v0;
+    else if (x >= fwd.x1)
+      volume[j] = fwd.v1;
+    else
+      volume[j] = fwd.v0 + (uint16_t)((int32_t)(fwd.v1 - fwd.v0) * (x - fwd.x0) / (fwd.x1 - fwd.x0));
+  }
+
+  max_volume = volume[segments];
+  if (max_volume == 0)
+    return false;
+  volume_scale = ((uint32_t)segments << scale_shift) / (uint32_t)max_volume;
+
+  // position over volume, the smallest position reaching it
+  CurveWalker inv(origin,first_position,last_position,volumes,n);
+  for (uint8_t j = 0; j <= segments; ++j) {
+    const uint16_t v = (uint32_t)max_volume * j / segments;
+    while ((inv.v1 < v) && (inv.next()));
+    if ((v <= inv.v0) || (inv.v1 == inv.v0))
+      position[j] = inv.x0;
+    else
+      position[j] = inv.x0 + (int16_t)((inv.x1 - inv.x0) * (int32_t)(v - inv.v0) / (int32_t)(inv.v1 - inv.v0));
+  }
+
+  // inverse slope of each segment
+  for (uint8_t j = 0; j < segments; ++j) {
+    const uint32_t dx = ((int32_t)max_position * (j + 1) / segments) - ((int32_t)max_position * j / segments);
+    const uint16_t dv = volume[j+1] - volume[j];
+    const uint32_t t  = dv ? (dx << frac_shift) / dv : 0xFFFF;
+    ticks_per_ml[j]   = t > 0xFFFF ? 0xFFFF : t;
+  }
+
+  valid = true;
+  return true;
+}
+
+uint8_t VolumeCurve::segment_of(const int16_t pos) const
+{
+  if (pos <= 0)
+    return 0;
+  if (pos >= max_position)
+    return segments - 1;
+  const uint8_t i = ((uint32_t)pos * position_scale) >> scale_shift;
+  return i < segments ? i : segments - 1;
+}
+
+uint16_t VolumeCurve::position_to_volume(const int16_t pos) const
+{
+  if ((!valid) || (pos <= origin_position))
+    return 0;
+  if (pos >= max_position)
+    return volume[segments];
+  const uint16_t t = ((uint32_t)pos * position_scale) >> (scale_shift - frac_shift);
+  const uint8_t  i = t >> frac_shift;
+  const uint8_t  f = t & ((1 << frac_shift) - 1);
+  if (i >= segments)
+    return volume[segments];
+  return volume[i] + (uint16_t)(((uint32_t)(volume[i+1] - volume[i]) * f) >> frac_shift);
+}
+
+uint16_t VolumeCurve::flow_to_speed(const int16_t pos, const uint16_t ml_per_s) const
+{
+  if (!valid)
+    return 0;
+  const uint32_t speed = ((uint32_t)ml_per_s * ticks_per_ml[segment_of(pos)]) >> frac_shift;
+  return speed > 0xFFFF ? 0xFFFF : speed;
+}
+
+int16_t VolumeCurve::volume_to_position(const uint16_t ml) const
+{
+  if (!valid)
+    return 0;
+  if (ml == 0)
+    return origin_position;
+  if (ml >= max_volume)
+    return position[segments];
+  const uint16_t t = ((uint32_t)ml * volume_scale) >> (scale_shift - frac_shift);
+  const uint8_t  i = t >> frac_shift;
+  const uint8_t  f = t & ((1 << frac_shift) - 1);
+  if (i >= segments)
+    return position[segments];
+  return position[i] + (int16_t)(((uint32_t)(position[i+1] - position[i]) * f) >> frac_shift);
+}
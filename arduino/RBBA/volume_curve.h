@@ -0,0 +1,89 @@
+#ifndef VOLUME_CURVE_H
+#define VOLUME_CURVE_H
+
+#include <stdint.h>
+
+/*
+  Conversion between motor position (encoder ticks) and displaced bag
+  volume (ml)
+
+  build() takes the calibrated volumes at evenly spaced positions and
+  makes them monotone (a volume is never less than the one before).
+  Together with the origin (the rest position of the bag, 0 ml) they form
+  a piecewise linear curve, which is sampled into two tables of 
+  segments + 1 entries (positions up to the origin displace nothing):
+  volume over evenly spaced positions and position over evenly spaced
+  volumes. Where the curve is flat, the inverse yields the smallest
+  position reaching the volume.
+
+  All divisions happen in build(). Afterwards, both directions are a
+  multiplication with a precomputed reciprocal to get the table index
+  and an interpolation between two neighbouring entries.
+
+  For flow control, build() also stores the inverse slope (dx/dV) of 
+  every segment of the volume table, so a flow in ml/s turns into an 
+  encoder speed with one multiplication.
+*/
+
+class VolumeCurve {
+
+public:
+
+  static const uint8_t segments = 32;
+
+private:
+
+  // fractional bits of the table position
+  static const uint8_t scale_shift = 20;
+  static const uint8_t frac_shift  = 8;
+
+  uint16_t volume[segments + 1];   // ml at max_position * i / segments
+  int16_t  position[segments + 1]; // ticks at max_volume * i / segments
+  uint16_t ticks_per_ml[segments]; // per segment of volume, 8 fractional bits
+
+  int16_t  origin_position;
+  int16_t  max_position;
+  uint16_t max_volume;
+  // segments << scale_shift divided by max_position and max_volume
+  uint32_t position_scale;
+  uint32_t volume_scale;
+
+  bool valid;
+
+public:
+
+  VolumeCurve();
+
+  // volumes holds n >= 2 volumes in ml displaced from the origin at n
+  // evenly spaced positions from first_position up to last_position,
+  // points not beyond the origin are ignored, returns false (and the 
+  // curve is invalid) if there is no range or no volume
+  bool build(
+    const int16_t   origin,
+    const int16_t   first_position,
+    const int16_t   last_position,
+    const uint16_t *volumes,
+    const uint8_t   n
+  );
+
+  void invalidate() { valid = false; }
+  bool is_valid() const { return valid; }
+
+  int16_t  get_max_position() const { return max_position; }
+  uint16_t get_max_volume() const { return max_volume; }
+
+  // both clamp to the range of the curve
+  uint16_t position_to_volume(const int16_t pos) const;
+  int16_t  volume_to_position(const uint16_t ml) const;
+
+  // encoder speed in ticks/s that yields ml_per_s at pos, 
+  // saturates where the curve is (almost) flat
+  uint16_t flow_to_speed(const int16_t pos, const uint16_t ml_per_s) const;
+
+private:
+
+  uint8_t segment_of(const int16_t pos) const;
+
+};
+
+#endif
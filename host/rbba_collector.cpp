@@ -0,0 +1,380 @@
+/* Telemetry collector for many RBBA units
+
+Reads the binary telemetry frames (see arduino/RBBA/telemetry_frame.h)
+of any number of devices from serial ports or pseudo terminals, all in
+one thread with epoll. Frames are parsed in place in the receive buffer
+of each device; only the incomplete frame at the end of a read (less
+than a frame) is moved to the front of the buffer.
+
+Per device the samples run through the same PressureLog as on the
+device, so the breath metrics (PIP, PEEP, plateau) are computed the
+same way. Each completed breath is printed and appended to
+<name>.breaths.csv, every sample is appended to <name>.rbt as a fixed
+size record (see sample_record.h) through a large write buffer. A new
+.rbt file starts with a header giving the record layout.
+
+usage: rbba_collector [-o output_dir] [-b baud] device...
+
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <termios.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <string>
+#include <vector>
+
+#include "telemetry_frame.h"
+#include "pressure_log.h"
+#include "sample_record.h"
+
+static volatile sig_atomic_t running = 1;
+
+static void on_signal(int)
+{
+  running = 0;
+}
+
+class OutputFile {
+
+  static const size_t buffer_size = 64 * 1024;
+
+  FILE   *file;
+  uint8_t buffer[buffer_size];
+  size_t  fill;
+
+public:
+
+  OutputFile() : file(nullptr), fill(0) {}
+  ~OutputFile() { close(); }
+
+  bool open(const std::string &path) {
+    file = fopen(path.c_str(),"ab");
+    if (file)
+      fseek(file,0,SEEK_END);
+    return file != nullptr;
+  }
+
+  bool is_empty() const {
+    return (file) && (fill == 0) && (ftell(file) == 0);
+  }
+
+  void write(const void *data, const size_t size) {
+    if (fill + size > buffer_size)
+      flush();
+    memcpy(buffer + fill,data,size);
+    fill += size;
+  }
+
+  void flush() {
+    if ((file) && (fill)) {
+      fwrite(buffer,1,fill,file);
+      fflush(file);
+    }
+    fill = 0;
+  }
+
+  void close() {
+    flush();
+    if (file)
+      fclose(file);
+    file = nullptr;
+  }
+
+};
+
+struct Device {
+
+  static const size_t rx_size = 4096;
+
+  std::string name;
+  int fd;
+
+  uint8_t rx[rx_size];
+  size_t  rx_fill;
+
+  TelemetryDecoder     decoder;
+  PressureLog<16,4,4>  pressure_log;
+  uint8_t              breath_cnt;
+  uint8_t              alarms; // latched alarm flags of the device
+
+  OutputFile samples;
+  FILE      *breaths;
+
+  uint64_t sample_cnt;
+  uint64_t byte_cnt;
+
+  Device() : fd(-1), rx_fill(0), breath_cnt(0), alarms(0), breaths(nullptr), sample_cnt(0), byte_cnt(0) {}
+
+};
+
+static speed_t baud_to_speed(const long baud)
+{
+  switch (baud) {
+    case 9600   : return B9600;
+    case 19200  : return B19200;
+    case 38400  : return B38400;
+    case 57600  : return B57600;
+    case 115200 : return B115200;
+    case 230400 : return B230400;
+    default     : return B115200;
+  }
+}
+
+static bool open_device(Device &d, const char *path, const long baud, const std::string &out_dir)
+{
+  d.fd = open(path,O_RDWR | O_NOCTTY | O_NONBLOCK);
+  if (d.fd < 0) {
+    fprintf(stderr,"%s: %s\n",path,strerror(errno));
+    return false;
+  }
+  termios tio;
+  if (tcgetattr(d.fd,&tio) == 0) {
+    cfmakeraw(&tio);
+    cfsetspeed(&tio,baud_to_speed(baud));
+    tio.c_cflag |= CLOCAL | CREAD;
+    tcsetattr(d.fd,TCSANOW,&tio);
+  }
+
+  // /dev/ttyUSB0 -> ttyUSB0, /dev/pts/3 -> pts_3
+  std::string name = path;
+  if (name.compare(0,5,"/dev/") == 0)
+    name = name.substr(5);
+  for (char &c : name)
+    if (c == '/')
+      c = '_';
+  d.name = name;
+
+  const std::string base = out_dir + "/" + name;
+  // records are only appended to a file of the same layout
+  if (FILE *f = fopen((base + ".rbt").c_str(),"rb")) {
+    SampleFileHeader h;
+    const SampleFileHeader ours = make_sample_file_header();
+    const bool empty = fread(&h,1,sizeof(h),f) == 0;
+    fclose(f);
+    if ((!empty) && (memcmp(&h,&ours,sizeof(h)) != 0)) {
+      fprintf(stderr,"%s.rbt: different record format, use another output directory\n",base.c_str());
+      return false;
+    }
+  }
+  if (!d.samples.open(base + ".rbt")) {
+    fprintf(stderr,"%s.rbt: %s\n",base.c_str(),strerror(errno));
+    return false;
+  }
+  if (d.samples.is_empty()) {
+    const SampleFileHeader h = make_sample_file_header();
+    d.samples.write(&h,sizeof(h));
+  }
+  d.breaths = fopen((base + ".breaths.csv").c_str(),"a");
+  if (!d.breaths) {
+    fprintf(stderr,"%s.breaths.csv: %s\n",base.c_str(),strerror(errno));
+    return false;
+  }
+  return true;
+}
+
+static void handle_sample(Device &d, const TelemetrySample &s)
+{
+  SampleRecord r;
+  r.time_ms      = s.time_ms;
+  r.pressure     = s.pressure;
+  r.enc_value    = s.enc_value;
+  r.set_position = s.set_position;
+  r.pwm          = s.pwm;
+  memcpy(r.state,s.state,sizeof(r.state));
+  r.dropped      = s.dropped;
+  d.samples.write(&r,sizeof(r));
+  ++d.sample_cnt;
+
+  // alarms are the last state, see AlarmEngine for the flags
+  const uint8_t alarms = s.state[TelemetrySample::nr_of_states - 1];
+  if (alarms != d.alarms) {
+    d.alarms = alarms;
+    printf("%-12s t=%10u alarms %02x\n",d.name.c_str(),s.time_ms,alarms);
+  }
+
+  d.pressure_log.add((uint16_t)s.time_ms,s.pressure);
+  if (d.pressure_log.get_breath_count() != d.breath_cnt) {
+    d.breath_cnt = d.pressure_log.get_breath_count();
+    fprintf(d.breaths,"%u,%d,%d,%d,%u\n",
+      s.time_ms,
+      d.pressure_log.get_pip(),
+      d.pressure_log.get_peep(),
+      d.pressure_log.get_plateau(),
+      d.pressure_log.get_breath_duration());
+    printf("%-12s t=%10u PIP %5d PEEP %5d plateau %5d Pa, %5u ms\n",
+      d.name.c_str(),
+      s.time_ms,
+      d.pressure_log.get_pip(),
+      d.pressure_log.get_peep(),
+      d.pressure_log.get_plateau(),
+      d.pressure_log.get_breath_duration());
+  }
+}
+
+// returns false if the device is gone
+static bool read_device(Device &d)
+{
+  for (;;) {
+    const ssize_t n = read(d.fd,d.rx + d.rx_fill,Device::rx_size - d.rx_fill);
+    if (n < 0) {
+      if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+        return true;
+      if (errno == EINTR)
+        continue;
+      return false; // e.g., EIO after the other side of a pty closed
+    }
+    if (n == 0)
+      return false;
+    d.rx_fill  += n;
+    d.byte_cnt += n;
+
+    size_t pos = 0;
+    TelemetrySample s;
+    while (pos < d.rx_fill) {
+      uint32_t consumed = 0;
+      const TelemetryDecoder::Result r = d.decoder.parse(d.rx + pos,d.rx_fill - pos,s,consumed);
+      if (r == TelemetryDecoder::Result::need_more)
+        break;
+      pos += consumed;
+      if (r == TelemetryDecoder::Result::sample)
+        handle_sample(d,s);
+    }
+    // keep the incomplete frame (if any)
+    d.rx_fill -= pos;
+    if ((d.rx_fill) && (pos))
+      memmove(d.rx,d.rx + pos,d.rx_fill);
+  }
+}
+
+static void close_device(Device &d, const int epfd)
+{
+  if (d.fd < 0)
+    return;
+  epoll_ctl(epfd,EPOLL_CTL_DEL,d.fd,nullptr);
+  close(d.fd);
+  d.fd = -1;
+  d.samples.flush();
+  if (d.breaths)
+    fflush(d.breaths);
+  fprintf(stderr,"%s: closed\n",d.name.c_str());
+}
+
+static uint64_t now_ms()
+{
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void usage()
+{
+  fprintf(stderr,"usage: rbba_collector [-o output_dir] [-b baud] device...\n");
+}
+
+int main(int argc, char **argv)
+{
+  std::string out_dir = ".";
+  long baud = 115200;
+  int opt;
+  while ((opt = getopt(argc,argv,"o:b:h")) != -1) {
+    switch (opt) {
+      case 'o' : out_dir = optarg; break;
+      case 'b' : baud = atol(optarg); break;
+      default  : usage(); return 1;
+    }
+  }
+  if (optind >= argc) {
+    usage();
+    return 1;
+  }
+
+  signal(SIGINT,on_signal);
+  signal(SIGTERM,on_signal);
+
+  const int epfd = epoll_create1(0);
+  if (epfd < 0) {
+    perror("epoll_create1");
+    return 1;
+  }
+
+  // devices are never moved, epoll keeps pointers to them
+  const size_t nr_of_devices = argc - optind;
+  std::vector<Device> devices(nr_of_devices);
+  size_t open_cnt = 0;
+  for (size_t i = 0; i < nr_of_devices; ++i) {
+    Device &d = devices[i];
+    if (!open_device(d,argv[optind + i],baud,out_dir)) {
+      if (d.fd >= 0)
+        close(d.fd);
+      d.fd = -1;
+      continue;
+    }
+    epoll_event ev;
+    ev.events   = EPOLLIN;
+    ev.data.ptr = &d;
+    if (epoll_ctl(epfd,EPOLL_CTL_ADD,d.fd,&ev) < 0) {
+      perror("epoll_ctl");
+      close(d.fd);
+      d.fd = -1;
+      continue;
+    }
+    ++open_cnt;
+  }
+
+  const int max_events = 64;
+  epoll_event events[max_events];
+  uint64_t last_flush = now_ms();
+  while ((running) && (open_cnt > 0)) {
+    const int n = epoll_wait(epfd,events,max_events,1000);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      perror("epoll_wait");
+      break;
+    }
+    for (int i = 0; i < n; ++i) {
+      Device &d = *static_cast<Device*>(events[i].data.ptr);
+      bool alive = true;
+      if (events[i].events & EPOLLIN)
+        alive = read_device(d);
+      if ((events[i].events & (EPOLLHUP | EPOLLERR)) && (!(events[i].events & EPOLLIN)))
+        alive = false;
+      if (!alive) {
+        close_device(d,epfd);
+        --open_cnt;
+      }
+    }
+    // the files are flushed about once a second, no matter how busy we are
+    if (now_ms() - last_flush >= 1000) {
+      last_flush = now_ms();
+      for (Device &d : devices) {
+        d.samples.flush();
+        if (d.breaths)
+          fflush(d.breaths);
+      }
+    }
+  }
+
+  for (Device &d : devices) {
+    close_device(d,epfd);
+    d.samples.close();
+    if (d.breaths)
+      fclose(d.breaths);
+    fprintf(stderr,"%-12s %10llu bytes %8llu samples %6u lost frames %6u crc errors\n",
+      d.name.c_str(),
+      (unsigned long long)d.byte_cnt,
+      (unsigned long long)d.sample_cnt,
+      (unsigned)d.decoder.get_lost_frames(),
+      (unsigned)d.decoder.get_crc_errors());
+  }
+  close(epfd);
+  return 0;
+}
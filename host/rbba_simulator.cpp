@@ -0,0 +1,190 @@
+/* Simulated RBBA units on pseudo terminals
+
+Opens N pty pairs, prints the names of their slave sides (one per line)
+and writes a synthetic breath waveform as telemetry frames (see 
+arduino/RBBA/telemetry_frame.h) to each of them at the given rate.
+Every device breathes with a slightly different rate and pressure, so
+the results of the collector can be told apart. If the pty is full 
+(nobody reads), frames are dropped the same way the device does it.
+With -e, a spontaneous inspiratory effort (a dip of effort_pa below 
+PEEP) starts at 80% of every breath, for testing the trigger detector
+with rbba_trigger_replay.
+
+usage: rbba_simulator [-n devices] [-r rate_hz] [-t seconds] [-e effort_pa]
+
+*/
+
+#define _XOPEN_SOURCE 600
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <signal.h>
+#include <unistd.h>
+#include <termios.h>
+#include <sys/timerfd.h>
+#include <vector>
+
+#include "telemetry_frame.h"
+
+static volatile sig_atomic_t running = 1;
+
+static void on_signal(int)
+{
+  running = 0;
+}
+
+struct SimDevice {
+  int master_fd;
+  int slave_fd; // kept open, so the pty survives until a collector opens it
+
+  TelemetryEncoder encoder;
+  uint8_t dropped;
+
+  double breath_period_ms;
+  double pip;
+  double peep;
+  double effort;
+  uint32_t seed;
+
+  SimDevice() : master_fd(-1), slave_fd(-1), dropped(0), breath_period_ms(3000), pip(2000), peep(500), effort(0), seed(1) {}
+};
+
+static bool open_pty(SimDevice &d)
+{
+  d.master_fd = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+  if ((d.master_fd < 0) || (grantpt(d.master_fd) < 0) || (unlockpt(d.master_fd) < 0)) {
+    perror("posix_openpt");
+    return false;
+  }
+  const char *name = ptsname(d.master_fd);
+  d.slave_fd = open(name,O_RDWR | O_NOCTTY | O_NONBLOCK);
+  if (d.slave_fd < 0) {
+    perror(name);
+    return false;
+  }
+  termios tio;
+  tcgetattr(d.slave_fd,&tio);
+  cfmakeraw(&tio);
+  tcsetattr(d.slave_fd,TCSANOW,&tio);
+  printf("%s\n",name);
+  return true;
+}
+
+// small deterministic noise generator, +-amplitude
+static double noise(uint32_t &seed, const double amplitude)
+{
+  seed = seed * 1664525u + 1013904223u;
+  return ((double)(seed >> 8) / (double)(1 << 24) * 2.0 - 1.0) * amplitude;
+}
+
+// inspiration ramp for a third of the breath, a short plateau and an
+// exponential decay towards PEEP for the rest, with the optional effort
+// as a half sine of effort_ms from 80% of the breath on
+static double waveform(const SimDevice &d, const double t_ms)
+{
+  const double effort_ms = 500.0;
+  const double phase = fmod(t_ms,d.breath_period_ms) / d.breath_period_ms;
+  const double plateau = d.pip * 0.9;
+  if (phase < 0.3)
+    return d.peep + (d.pip - d.peep) * phase / 0.3;
+  if (phase < 0.4)
+    return plateau;
+  double p = d.peep + (plateau - d.peep) * exp(-(phase - 0.4) * 12.0);
+  const double effort_t = (phase - 0.8) * d.breath_period_ms;
+  if ((effort_t > 0.0) && (effort_t < effort_ms))
+    p -= d.effort * sin(M_PI * effort_t / effort_ms);
+  return p;
+}
+
+static void usage()
+{
+  fprintf(stderr,"usage: rbba_simulator [-n devices] [-r rate_hz] [-t seconds] [-e effort_pa]\n");
+}
+
+int main(int argc, char **argv)
+{
+  int nr_of_devices = 4;
+  int rate_hz = 50;
+  int duration_s = 0;
+  int effort_pa = 0;
+  int opt;
+  while ((opt = getopt(argc,argv,"n:r:t:e:h")) != -1) {
+    switch (opt) {
+      case 'n' : nr_of_devices = atoi(optarg); break;
+      case 'r' : rate_hz = atoi(optarg); break;
+      case 't' : duration_s = atoi(optarg); break;
+      case 'e' : effort_pa = atoi(optarg); break;
+      default  : usage(); return 1;
+    }
+  }
+  if ((nr_of_devices < 1) || (rate_hz < 1) || (rate_hz > 1000)) {
+    usage();
+    return 1;
+  }
+
+  signal(SIGINT,on_signal);
+  signal(SIGTERM,on_signal);
+
+  std::vector<SimDevice> devices(nr_of_devices);
+  for (int i = 0; i < nr_of_devices; ++i) {
+    SimDevice &d = devices[i];
+    if (!open_pty(d))
+      return 1;
+    d.breath_period_ms = 2500 + 250 * (i % 8);
+    d.pip  = 1800 + 50 * (i % 10);
+    d.peep = 400 + 20 * (i % 5);
+    d.effort = effort_pa;
+    d.seed = i + 1;
+  }
+  fflush(stdout);
+
+  const int tfd = timerfd_create(CLOCK_MONOTONIC,0);
+  itimerspec its;
+  its.it_interval.tv_sec  = 0;
+  its.it_interval.tv_nsec = 1000000000L / rate_hz;
+  its.it_value = its.it_interval;
+  timerfd_settime(tfd,0,&its,nullptr);
+
+  const uint32_t tick_ms = 1000 / rate_hz;
+  uint32_t time_ms = 0;
+  uint64_t ticks_left = (uint64_t)duration_s * rate_hz;
+  while ((running) && ((duration_s == 0) || (ticks_left > 0))) {
+    uint64_t expirations;
+    if (read(tfd,&expirations,sizeof(expirations)) != sizeof(expirations))
+      continue;
+    time_ms += tick_ms;
+    if (ticks_left)
+      --ticks_left;
+    for (SimDevice &d : devices) {
+      TelemetrySample s;
+      const double p = waveform(d,time_ms) + noise(d.seed,15.0);
+      s.time_ms      = time_ms;
+      s.pressure     = (int16_t)lround(p);
+      s.set_position = (int16_t)lround(p / 20.0);
+      s.enc_value    = (int16_t)(s.set_position + lround(noise(d.seed,2.0)));
+      s.pwm          = (int16_t)lround(noise(d.seed,100.0) + 100.0);
+      s.state[0]     = 0;
+      s.state[1]     = 0;
+      s.state[2]     = 0;
+      s.state[3]     = 0;
+      s.dropped      = d.dropped;
+      uint8_t frame[TelemetryFrame::max_size];
+      const uint8_t size = d.encoder.encode(s,frame);
+      if (write(d.master_fd,frame,size) != size) {
+        ++d.dropped;
+        d.encoder.invalidate();
+      }
+    }
+  }
+
+  for (SimDevice &d : devices) {
+    close(d.slave_fd);
+    close(d.master_fd);
+  }
+  close(tfd);
+  return 0;
+}
@@ -0,0 +1,161 @@
+/* Trigger detection latency on recorded traces
+
+Replays the samples of .rbt files (written by rbba_collector, see
+sample_record.h, with or without the file header) through the TriggerDetector of the device and reports
+the triggers and their latency. The onset of an effort is taken as the
+last sample before the trigger that was less than a quarter of the
+sensitivity below the baseline of the detector at the time of the 
+trigger, so the latency is the time the pressure needs to fall by the 
+sensitivity plus the detection delay.
+Samples are as far apart as in the telemetry (one per control tick),
+on the device the detector sees every sensor sample.
+
+The IIR filter of the sensors delays the pressure seen by the detector.
+With -f, the trace is run through the filter with that coefficient (1:
+off, 2, 4, 8, 16) before the detector, as if the sensor converted every
+-c ms, while the onset is still taken from the unfiltered trace. The 
+defaults model the expiration profile of the device (x4, filter off, 
+13.3 ms), e.g., -f 4 -c 22.5 the one of the plateau (x8, c4).
+
+usage: rbba_trigger_replay [-s sensitivity_pa] [-r refractory_ms] [-f filter_coeff] [-c conversion_ms] [-v] file.rbt...
+
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <unistd.h>
+#include <vector>
+
+#include "trigger_detector.h"
+#include "pressure_log.h"
+#include "sample_record.h"
+
+struct Stats {
+  unsigned count;
+  uint32_t min;
+  uint32_t max;
+  uint64_t sum;
+
+  Stats() : count(0), min(UINT32_MAX), max(0), sum(0) {}
+
+  void add(const uint32_t v) {
+    ++count;
+    if (v < min) min = v;
+    if (v > max) max = v;
+    sum += v;
+  }
+
+  void print(const char *name) const {
+    if (count == 0)
+      printf("%-24s  no triggers\n",name);
+    else
+      printf("%-24s %5u triggers, latency min %4u avg %6.1f max %4u ms\n",
+        name,count,min,(double)sum / count,max);
+  }
+};
+
+static bool read_samples(const char *path, std::vector<SampleRecord> &samples)
+{
+  FILE *f = fopen(path,"rb");
+  if (!f) {
+    fprintf(stderr,"%s: %s\n",path,strerror(errno));
+    return false;
+  }
+  SampleFileHeader h;
+  if ((fread(&h,sizeof(h),1,f) != 1) || (!is_sample_file_header(h))) {
+    // written before the header was introduced
+    rewind(f);
+    h.version      = sample_file_version;
+    h.record_size  = legacy_record_size;
+    h.nr_of_states = legacy_nr_of_states;
+  }
+  uint8_t data[256];
+  SampleRecord r;
+  while (fread(data,h.record_size,1,f) == 1) {
+    if (!unpack_sample_record(h,data,r)) {
+      fprintf(stderr,"%s: unknown record format (version %u, %u bytes)\n",path,h.version,h.record_size);
+      fclose(f);
+      return false;
+    }
+    samples.push_back(r);
+  }
+  fclose(f);
+  return true;
+}
+
+static void usage()
+{
+  fprintf(stderr,"usage: rbba_trigger_replay [-s sensitivity_pa] [-r refractory_ms] [-f filter_coeff] [-c conversion_ms] [-v] file.rbt...\n");
+}
+
+int main(int argc, char **argv)
+{
+  int sensitivity = 100;
+  int refractory_ms = 500;
+  int filter_coeff = 1;
+  double conversion_ms = 13.3;
+  bool verbose = false;
+  int opt;
+  while ((opt = getopt(argc,argv,"s:r:f:c:vh")) != -1) {
+    switch (opt) {
+      case 's' : sensitivity = atoi(optarg); break;
+      case 'r' : refractory_ms = atoi(optarg); break;
+      case 'f' : filter_coeff = atoi(optarg); break;
+      case 'c' : conversion_ms = atof(optarg); break;
+      case 'v' : verbose = true; break;
+      default  : usage(); return 1;
+    }
+  }
+  if ((optind >= argc) || (sensitivity < 1) || (sensitivity > 255) || (refractory_ms < 0) || (refractory_ms > 65535) ||
+      ((filter_coeff != 1) && (filter_coeff != 2) && (filter_coeff != 4) && (filter_coeff != 8) && (filter_coeff != 16)) ||
+      (conversion_ms <= 0.0)) {
+    usage();
+    return 1;
+  }
+
+  Stats total;
+  for (int i = optind; i < argc; ++i) {
+    std::vector<SampleRecord> samples;
+    if (!read_samples(argv[i],samples))
+      return 1;
+
+    TriggerDetector detector((uint8_t)sensitivity,(uint16_t)refractory_ms);
+    PressureLog<16,4,4> pressure_log;
+    Stats stats;
+    // the sensor filter keeps (c-1)/c of the old value per conversion
+    const double keep_per_conversion = 1.0 - 1.0 / filter_coeff;
+    double filtered = samples.empty() ? 0.0 : samples[0].pressure;
+    for (size_t k = 0; k < samples.size(); ++k) {
+      const SampleRecord &s = samples[k];
+      if (k > 0) {
+        const double conversions = (s.time_ms - samples[k-1].time_ms) / conversion_ms;
+        filtered = s.pressure + (filtered - s.pressure) * pow(keep_per_conversion,conversions);
+      }
+      const int16_t p = (int16_t)lround(filtered);
+      pressure_log.add((uint16_t)s.time_ms,p);
+      if (!detector.add((uint16_t)s.time_ms,p))
+        continue;
+      const int16_t baseline = detector.get_baseline();
+      size_t onset = k;
+      while ((onset > 0) && (samples[onset-1].pressure < baseline - sensitivity / 4))
+        --onset;
+      if (onset > 0)
+        --onset;
+      const uint32_t latency = s.time_ms - samples[onset].time_ms;
+      stats.add(latency);
+      total.add(latency);
+      if (verbose)
+        printf("%s t=%10u baseline %5d Pa, onset t=%10u, latency %4u ms\n",
+          argv[i],s.time_ms,baseline,samples[onset].time_ms,latency);
+    }
+    stats.print(argv[i]);
+    printf("%-24s %5zu samples, %5u breaths\n","",samples.size(),pressure_log.get_breath_count());
+  }
+  if (argc - optind > 1)
+    total.print("total");
+  return 0;
+}
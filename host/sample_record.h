@@ -0,0 +1,65 @@
+#ifndef SAMPLE_RECORD_H
+#define SAMPLE_RECORD_H
+
+#include <stdint.h>
+#include <string.h>
+#include "telemetry_frame.h"
+
+// one record per sample in the .rbt files of the collector, 
+// little endian on x86
+struct __attribute__((packed)) SampleRecord {
+  uint32_t time_ms;
+  int16_t  pressure;
+  int16_t  enc_value;
+  int16_t  set_position;
+  int16_t  pwm;
+  uint8_t  state[TelemetrySample::nr_of_states];
+  uint8_t  dropped;
+};
+
+// every .rbt file starts with this header, so records of other layouts are 
+// recognized, files without it are from before: 16 byte records, 3 states
+struct __attribute__((packed)) SampleFileHeader {
+  char    magic[4];     // "RBTS"
+  uint8_t version;      // of the header
+  uint8_t record_size;  // bytes per record
+  uint8_t nr_of_states; // state bytes per record
+  uint8_t reserved;
+};
+
+static const char    sample_file_magic[4]  = {'R','B','T','S'};
+static const uint8_t sample_file_version   = 1;
+static const uint8_t legacy_record_size    = 16;
+static const uint8_t legacy_nr_of_states   = 3;
+
+inline SampleFileHeader make_sample_file_header()
+{
+  SampleFileHeader h;
+  memcpy(h.magic,sample_file_magic,sizeof(h.magic));
+  h.version      = sample_file_version;
+  h.record_size  = sizeof(SampleRecord);
+  h.nr_of_states = TelemetrySample::nr_of_states;
+  h.reserved     = 0;
+  return h;
+}
+
+inline bool is_sample_file_header(const SampleFileHeader &h)
+{
+  return memcmp(h.magic,sample_file_magic,sizeof(h.magic)) == 0;
+}
+
+// unpacks a record in the layout given by the header, missing states are 0
+inline bool unpack_sample_record(const SampleFileHeader &h, const uint8_t *data, SampleRecord &r)
+{
+  const uint8_t fixed = sizeof(SampleRecord) - TelemetrySample::nr_of_states - 1;
+  if ((h.version != sample_file_version) || (h.record_size != fixed + h.nr_of_states + 1))
+    return false;
+  memset(&r,0,sizeof(r));
+  memcpy(&r,data,fixed);
+  const uint8_t n = h.nr_of_states < TelemetrySample::nr_of_states ? h.nr_of_states : TelemetrySample::nr_of_states;
+  memcpy(r.state,data + fixed,n);
+  r.dropped = data[fixed + h.nr_of_states];
+  return true;
+}
+
+#endif